@@ -0,0 +1,307 @@
+// async_log.h
+// Асинхронный лог: горячий путь (рендер-цикл, GLFW-колбэки) только кладёт запись
+// фиксированного размера в lock-free очередь, а форматирование и запись в stderr
+// делает фоновый поток. Если очередь переполнена, запись отбрасывается (счётчик drop),
+// рендер никогда не ждёт вывода.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+enum class LogLevel : std::uint8_t {
+    Info,
+    Warn,
+    Error
+};
+
+// One structured key=value pair. Keys must be string literals (stored by pointer),
+// string values are copied into a fixed inline buffer (truncated if longer).
+// Only one value is live per field (see `type`), so they share storage: 64 bytes per field.
+struct LogField {
+    enum class Type : std::uint8_t { None, Int, Float, Str };
+
+    static constexpr std::size_t STR_LEN = 48;
+
+    const char* key = nullptr;
+    Type type = Type::None;
+    union {
+        long long i = 0;
+        double f;
+        char s[STR_LEN];
+    };
+
+    LogField() = default;
+    LogField(const char* k, int v) : key(k), type(Type::Int), i(v) {}
+    LogField(const char* k, unsigned v) : key(k), type(Type::Int), i(static_cast<long long>(v)) {}
+    LogField(const char* k, long v) : key(k), type(Type::Int), i(v) {}
+    LogField(const char* k, unsigned long v) : key(k), type(Type::Int), i(static_cast<long long>(v)) {}
+    LogField(const char* k, long long v) : key(k), type(Type::Int), i(v) {}
+    LogField(const char* k, unsigned long long v) : key(k), type(Type::Int), i(static_cast<long long>(v)) {}
+    LogField(const char* k, bool v) : key(k), type(Type::Int), i(v ? 1 : 0) {}
+    LogField(const char* k, float v) : key(k), type(Type::Float), f(v) {}
+    LogField(const char* k, double v) : key(k), type(Type::Float), f(v) {}
+    LogField(const char* k, const char* v) : key(k), type(Type::Str) {
+        std::strncpy(s, v ? v : "", STR_LEN - 1);
+        s[STR_LEN - 1] = '\0';
+    }
+    LogField(const char* k, const std::string& v) : LogField(k, v.c_str()) {}
+};
+
+// Records are copied into the queue on the producer's thread, so keep them small: messages
+// with more fields are split (the LOG_* macros reject more than MAX_FIELDS at compile time).
+struct LogRecord {
+    static constexpr int MAX_FIELDS = 6;
+
+    std::int64_t tsNs = 0;
+    const char*  msg = nullptr;   // string literal
+    LogLevel     level = LogLevel::Info;
+    std::uint8_t fieldCount = 0;
+    std::uint32_t suppressed = 0; // records dropped by the site's rate limit since the last emitted one
+    LogField     fields[MAX_FIELDS];
+};
+
+// Per call-site rate limiter. Lives as a function-local static inside the LOG_* macros,
+// so each message site is throttled independently (replaces ad-hoc "static lastLog" code).
+struct LogSite {
+    std::int64_t minIntervalNs;
+    std::atomic<std::int64_t> lastNs{INT64_MIN};
+    std::atomic<std::uint32_t> suppressed{0};
+
+    explicit LogSite(int minIntervalMs) : minIntervalNs(static_cast<std::int64_t>(minIntervalMs) * 1000000) {}
+
+    // Returns false if the record must be dropped; otherwise outSuppressed receives
+    // the number of records swallowed since the previous emitted one.
+    bool admit(std::int64_t nowNs, std::uint32_t& outSuppressed) {
+        if (minIntervalNs > 0) {
+            std::int64_t last = lastNs.load(std::memory_order_relaxed);
+            if (last != INT64_MIN && nowNs - last < minIntervalNs) {
+                suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (!lastNs.compare_exchange_strong(last, nowNs, std::memory_order_relaxed)) {
+                // Another thread emitted from this site at the same moment.
+                suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        outSuppressed = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+class AsyncLog {
+public:
+    static constexpr std::size_t CAPACITY = 1024; // power of two
+
+    static AsyncLog& instance() {
+        static AsyncLog log;
+        return log;
+    }
+
+    static std::int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - instance().startTime_).count();
+    }
+
+    // Bounded MPMC queue (D. Vyukov): one CAS per push, never blocks, never allocates.
+    bool push(const LogRecord& rec) {
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & (CAPACITY - 1)];
+            std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.rec = rec;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void start() {
+        if (running_.exchange(true)) return;
+        writer_ = std::thread([this] { writerLoop(); });
+    }
+
+    // Stops the writer and drains everything that is still queued.
+    // Safe to call without start() (drains synchronously) and more than once.
+    void stop() {
+        if (running_.exchange(false)) {
+            writer_.join();
+        }
+        drain();
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq{0};
+        LogRecord rec;
+    };
+
+    AsyncLog() : startTime_(std::chrono::steady_clock::now()) {
+        for (std::size_t i = 0; i < CAPACITY; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~AsyncLog() { stop(); }
+
+    bool pop(LogRecord& out) {
+        std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & (CAPACITY - 1)];
+            std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = cell.rec;
+                    cell.seq.store(pos + CAPACITY, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static void writeRecord(const LogRecord& rec) {
+        static const char LEVEL_CH[] = {'I', 'W', 'E'};
+        char line[1024];
+        int n = std::snprintf(line, sizeof(line), "[%9.3f] %c %s",
+                              static_cast<double>(rec.tsNs) / 1e9,
+                              LEVEL_CH[static_cast<int>(rec.level)],
+                              rec.msg ? rec.msg : "");
+        for (int k = 0; k < rec.fieldCount && n > 0 && n < static_cast<int>(sizeof(line)); ++k) {
+            const LogField& fld = rec.fields[k];
+            char* p = line + n;
+            std::size_t room = sizeof(line) - static_cast<std::size_t>(n);
+            switch (fld.type) {
+                case LogField::Type::Int:
+                    n += std::snprintf(p, room, " %s=%lld", fld.key, fld.i);
+                    break;
+                case LogField::Type::Float:
+                    n += std::snprintf(p, room, " %s=%g", fld.key, fld.f);
+                    break;
+                case LogField::Type::Str:
+                    n += std::snprintf(p, room, (std::strchr(fld.s, ' ') || fld.s[0] == '\0') ? " %s=\"%s\"" : " %s=%s",
+                                       fld.key, fld.s);
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (rec.suppressed > 0 && n > 0 && n < static_cast<int>(sizeof(line))) {
+            n += std::snprintf(line + n, sizeof(line) - static_cast<std::size_t>(n), " suppressed=%u", rec.suppressed);
+        }
+        if (n < 0) return;
+        if (n >= static_cast<int>(sizeof(line))) n = static_cast<int>(sizeof(line)) - 1;
+        line[n++] = '\n';
+        std::fwrite(line, 1, static_cast<std::size_t>(n), stderr);
+    }
+
+    void drain() {
+        LogRecord rec;
+        bool any = false;
+        while (pop(rec)) {
+            writeRecord(rec);
+            any = true;
+        }
+        std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reportedDropped_) {
+            std::fprintf(stderr, "[%9.3f] W Log queue overflow dropped=%llu\n",
+                         static_cast<double>(nowNs()) / 1e9,
+                         static_cast<unsigned long long>(dropped - reportedDropped_));
+            reportedDropped_ = dropped;
+            any = true;
+        }
+        if (any) std::fflush(stderr);
+    }
+
+    void writerLoop() {
+        // Producers never signal (no futex wake on the hot path); the writer just polls.
+        while (running_.load(std::memory_order_acquire)) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    Cell cells_[CAPACITY];
+    alignas(64) std::atomic<std::size_t> enqueuePos_{0};
+    alignas(64) std::atomic<std::size_t> dequeuePos_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+    std::uint64_t reportedDropped_ = 0;
+    std::atomic<bool> running_{false};
+    std::thread writer_;
+    std::chrono::steady_clock::time_point startTime_;
+};
+
+// Starts the writer thread for the lifetime of main() and drains the queue on every exit path.
+struct AsyncLogScope {
+    AsyncLogScope() { AsyncLog::instance().start(); }
+    ~AsyncLogScope() { AsyncLog::instance().stop(); }
+    AsyncLogScope(const AsyncLogScope&) = delete;
+    AsyncLogScope& operator=(const AsyncLogScope&) = delete;
+};
+
+inline void logPushFields(LogLevel level, LogSite& site, const char* msg, const LogField* fields, std::size_t count) {
+    std::int64_t now = AsyncLog::nowNs();
+    std::uint32_t suppressed = 0;
+    if (!site.admit(now, suppressed)) return;
+
+    LogRecord rec;
+    rec.tsNs = now;
+    rec.msg = msg;
+    rec.level = level;
+    rec.suppressed = suppressed;
+    for (std::size_t k = 0; k < count; ++k) {
+        rec.fields[rec.fieldCount++] = fields[k];
+    }
+    AsyncLog::instance().push(rec);
+}
+
+// LOG_* call without fields: `{}` selects this overload.
+struct LogNoFields {};
+
+inline void logPush(LogLevel level, LogSite& site, const char* msg, LogNoFields) {
+    logPushFields(level, site, msg, nullptr, 0);
+}
+
+// The field count is the deduced array size, so an over-long call fails to compile
+// instead of losing its last fields at runtime.
+template <std::size_t N>
+inline void logPush(LogLevel level, LogSite& site, const char* msg, const LogField (&fields)[N]) {
+    static_assert(N <= static_cast<std::size_t>(LogRecord::MAX_FIELDS),
+                  "too many fields for one log record: split the message");
+    logPushFields(level, site, msg, fields, N);
+}
+
+// Usage: LOG_INFO("FOV", {"fov_deg", g_fovYDeg});
+//        LOG_WARN_EVERY(2000, "XGetImage failed");   // at most once per 2 s from this site
+#define LOG_AT_(level, intervalMs, msg, ...)                              \
+    do {                                                                  \
+        static LogSite logSite_(intervalMs);                              \
+        logPush(level, logSite_, msg, {__VA_ARGS__});                     \
+    } while (0)
+
+#define LOG_INFO(msg, ...)  LOG_AT_(LogLevel::Info, 0, msg, __VA_ARGS__)
+#define LOG_WARN(msg, ...)  LOG_AT_(LogLevel::Warn, 0, msg, __VA_ARGS__)
+#define LOG_ERROR(msg, ...) LOG_AT_(LogLevel::Error, 0, msg, __VA_ARGS__)
+
+#define LOG_INFO_EVERY(ms, msg, ...)  LOG_AT_(LogLevel::Info, ms, msg, __VA_ARGS__)
+#define LOG_WARN_EVERY(ms, msg, ...)  LOG_AT_(LogLevel::Warn, ms, msg, __VA_ARGS__)
+#define LOG_ERROR_EVERY(ms, msg, ...) LOG_AT_(LogLevel::Error, ms, msg, __VA_ARGS__)
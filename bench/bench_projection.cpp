@@ -0,0 +1,147 @@
+// bench_projection.cpp
+// Headless benchmark of the per-pointer-event / per-frame CPU math (no GL, no X11).
+// Также служит тренировочной нагрузкой для PGO (см. scripts/pgo_train.sh).
+//
+// Usage: bench_projection [--quick]
+
+#include "async_log.h"
+#include "damage.h"
+#include "pose_history.h"
+#include "projection.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Sweeps a grid of screen points through ndc -> world ray -> capture UV, the same path
+// viewMouseToCaptureXY() takes, for a rotating camera.
+double benchMapping(ProjectionMode mode, int frames, int grid, long long& hits) {
+    const float aspect = 16.0f / 9.0f;
+    const float thetaMaxRad = 80.0f * 3.14159265358979323846f / 180.0f;
+    hits = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+        float yaw = static_cast<float>(f) * 3.0f;
+        float pitch = 60.0f * std::sin(static_cast<float>(f) * 0.02f);
+        float sphericity = 0.5f + 0.5f * std::sin(static_cast<float>(f) * 0.05f);
+        for (int gy = 0; gy < grid; ++gy) {
+            for (int gx = 0; gx < grid; ++gx) {
+                float ndcX = 2.0f * (gx + 0.5f) / grid - 1.0f;
+                float ndcY = 1.0f - 2.0f * (gy + 0.5f) / grid;
+                Vec3 dir = ndcToWorldDir(ndcX, ndcY, aspect, 90.0f, yaw, pitch);
+                float u = 0.0f, v = 0.0f;
+                if (dirToCaptureUV(mode, sphericity, thetaMaxRad, dir, u, v)) {
+                    hits += static_cast<long long>(u * 5120.0f) + static_cast<long long>(v * 2880.0f);
+                }
+            }
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    return ns / (static_cast<double>(frames) * grid * grid);
+}
+
+// Pointer-event path with latency compensation: look up the pose shown ~100 ms ago
+// in a full history (worst case walks back ~6 frames at 60 fps).
+double benchPoseLookup(int count, long long& hits) {
+    PoseHistory history;
+    const std::int64_t frameNs = 16666667;
+    for (std::size_t f = 0; f < PoseHistory::CAPACITY; ++f) {
+        RenderPose p;
+        p.frameId = f;
+        p.presentNs = static_cast<std::int64_t>(f) * frameNs;
+        p.yawDeg = static_cast<float>(f) * 3.0f;
+        history.push(p);
+    }
+    std::int64_t newest = static_cast<std::int64_t>(PoseHistory::CAPACITY - 1) * frameNs;
+    hits = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        RenderPose p;
+        std::int64_t at = newest - 100000000 + (i % 64) * 1000000;
+        if (history.poseAt(at, p)) hits += static_cast<long long>(p.frameId);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / count;
+}
+
+// Per-frame damage fan-out: a few small source rects (clock, gears) -> mesh patches -> view rects.
+double benchDamageFanOut(ProjectionMode mode, int frames, long long& hits) {
+    const float thetaMaxRad = 80.0f * 3.14159265358979323846f / 180.0f;
+    DamageFrame dmg;
+    std::vector<SurfacePatch> patches;
+    std::vector<ViewRect> views;
+    hits = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+        dmg.reset(5120, 2880);
+        dmg.add({3400 + (f % 50), 1300, 164, 164});
+        dmg.add({3900, 1500 + (f % 30), 300, 300});
+        dmg.add({200, 200, 64, 32});
+        RenderPose pose;
+        pose.mode = mode;
+        pose.yawDeg = static_cast<float>(f % 360);
+        pose.sphericity = 0.5f;
+        damageToSurfacePatches(mode, dmg, 64, 128, patches);
+        surfacePatchesToViewRects(patches, pose, thetaMaxRad, 64, 128, 1280, 720, views);
+        for (const ViewRect& v : views) hits += viewRectArea(v);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / frames;
+}
+
+// Cost of one enqueue on the hot path while the writer drains in the background.
+double benchLogPush(int count) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        LOG_INFO_EVERY(1000, "bench log push", {"i", i}, {"fov_deg", 90.0f});
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / count;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = (argc > 1 && std::strcmp(argv[1], "--quick") == 0);
+    int frames = quick ? 20 : 600;
+    int grid = 64;
+
+    AsyncLogScope logScope;
+
+    ProjectionMode modes[] = {ProjectionMode::Sphere, ProjectionMode::SphereClamp,
+                              ProjectionMode::Cylinder, ProjectionMode::Morph};
+    long long checksum = 0;
+    for (ProjectionMode mode : modes) {
+        long long hits = 0;
+        double ns = benchMapping(mode, frames, grid, hits);
+        checksum += hits;
+        std::printf("mapping %-12s %8.1f ns/ray\n", projectionModeName(mode), ns);
+        if (hits == 0) {
+            std::fprintf(stderr, "mapping %s produced no hits\n", projectionModeName(mode));
+            return 1;
+        }
+    }
+
+    for (ProjectionMode mode : modes) {
+        long long hits = 0;
+        double us = benchDamageFanOut(mode, quick ? 50 : 5000, hits);
+        checksum += hits;
+        std::printf("damage fan-out %-12s %8.2f us/frame\n", projectionModeName(mode), us);
+    }
+
+    long long poseHits = 0;
+    double poseNs = benchPoseLookup(quick ? 10000 : 1000000, poseHits);
+    checksum += poseHits;
+    std::printf("pose history lookup (100 ms back) %8.1f ns/event\n", poseNs);
+
+    double logNs = benchLogPush(quick ? 10000 : 1000000);
+    std::printf("log push (rate-limited site) %8.1f ns/call\n", logNs);
+    std::printf("checksum %lld\n", checksum);
+    return 0;
+}
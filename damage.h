@@ -0,0 +1,318 @@
+// damage.h
+// Единая модель повреждений кадра: какие прямоугольники захваченного рабочего стола (source space)
+// изменились в кадре seq, и во что они превращаются после проекции — в диапазоны ячеек меша
+// (surface patches) и в прямоугольники на экране VIEW (view space). Каждый потребитель
+// (загрузка текстуры, рендер, статистика) работает пропорционально изменившейся площади.
+#pragma once
+
+#include "pose_history.h"
+#include "projection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Source-space rectangle in capture pixels (origin top-left, like X11).
+struct DamageRect {
+    int x = 0;
+    int y = 0;
+    int w = 0;
+    int h = 0;
+};
+
+static inline long long rectArea(const DamageRect& r) {
+    return static_cast<long long>(r.w) * static_cast<long long>(r.h);
+}
+
+// Overlapping or edge-adjacent.
+static inline bool rectsTouch(const DamageRect& a, const DamageRect& b) {
+    return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+}
+
+static inline DamageRect rectUnion(const DamageRect& a, const DamageRect& b) {
+    int x0 = std::min(a.x, b.x);
+    int y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.w, b.x + b.w);
+    int y1 = std::max(a.y + a.h, b.y + b.h);
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+// Damage of one captured frame. Rects are clipped, merged when they touch and collapsed to
+// "full" when there are too many of them or they cover most of the frame (one big grab is
+// cheaper than many X round trips then).
+struct DamageFrame {
+    static constexpr std::size_t MAX_RECTS = 16;
+    static constexpr double FULL_FRACTION = 0.6;
+
+    std::uint64_t seq = 0; // capture sequence number; 0 = nothing captured yet
+    int  width = 0;
+    int  height = 0;
+    bool full = false;
+    std::vector<DamageRect> rects;
+
+    void reset(int w, int h) {
+        width = w;
+        height = h;
+        full = false;
+        rects.clear();
+    }
+
+    void markFull() {
+        full = true;
+        rects.clear();
+    }
+
+    bool empty() const { return !full && rects.empty(); }
+
+    long long area() const {
+        if (full) return static_cast<long long>(width) * static_cast<long long>(height);
+        long long a = 0;
+        for (const DamageRect& r : rects) a += rectArea(r);
+        return a;
+    }
+
+    void add(DamageRect r) {
+        if (full) return;
+        int x0 = std::max(r.x, 0);
+        int y0 = std::max(r.y, 0);
+        int x1 = std::min(r.x + r.w, width);
+        int y1 = std::min(r.y + r.h, height);
+        if (x1 <= x0 || y1 <= y0) return;
+        r = {x0, y0, x1 - x0, y1 - y0};
+
+        // Merge until stable: a grown rect can start touching ones it skipped before.
+        for (std::size_t i = 0; i < rects.size();) {
+            if (rectsTouch(rects[i], r)) {
+                r = rectUnion(rects[i], r);
+                rects[i] = rects.back();
+                rects.pop_back();
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        rects.push_back(r);
+
+        if (rects.size() > MAX_RECTS) {
+            DamageRect all = rects[0];
+            for (const DamageRect& q : rects) all = rectUnion(all, q);
+            rects.assign(1, all);
+        }
+        if (static_cast<double>(area()) > FULL_FRACTION * static_cast<double>(width) * static_cast<double>(height)) {
+            markFull();
+        }
+    }
+};
+
+// Half-open range of mesh cells [ring0, ring1) x [sector0, sector1) covering some damage.
+// A partial redraw submits exactly these cells, not the whole mesh.
+struct SurfacePatch {
+    int ring0 = 0;
+    int ring1 = 0;
+    int sector0 = 0;
+    int sector1 = 0;
+};
+
+static inline long long patchCells(const SurfacePatch& p) {
+    return static_cast<long long>(p.ring1 - p.ring0) * static_cast<long long>(p.sector1 - p.sector0);
+}
+
+// Merges overlapping or edge-adjacent patches until none touch, so no cell is submitted twice.
+static inline void mergeSurfacePatches(std::vector<SurfacePatch>& patches) {
+    std::vector<SurfacePatch> merged;
+    for (SurfacePatch p : patches) {
+        for (std::size_t i = 0; i < merged.size();) {
+            const SurfacePatch& o = merged[i];
+            if (o.ring0 <= p.ring1 && p.ring0 <= o.ring1 && o.sector0 <= p.sector1 && p.sector0 <= o.sector1) {
+                p = {std::min(o.ring0, p.ring0), std::max(o.ring1, p.ring1),
+                     std::min(o.sector0, p.sector0), std::max(o.sector1, p.sector1)};
+                merged[i] = merged.back();
+                merged.pop_back();
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        merged.push_back(p);
+    }
+    patches.swap(merged);
+}
+
+// Source rects -> mesh cells of the given projection. Mirrors the texture coordinates of
+// drawTextured*(): cylinder rows run top->bottom (v = r / rings), the sphere-like meshes run
+// bottom->top (v = 1 - r / rings); u = s / sectors everywhere.
+// GL_LINEAR mixes every texel into samples up to one texel away, and the texture repeats
+// (default GL_REPEAT), so each rect grows by one pixel and what falls off an edge wraps around.
+static inline void damageToSurfacePatches(ProjectionMode mode, const DamageFrame& dmg, int rings, int sectors,
+                                          std::vector<SurfacePatch>& out) {
+    out.clear();
+    if (dmg.empty() || dmg.width <= 0 || dmg.height <= 0) return;
+    if (dmg.full) {
+        out.push_back({0, rings, 0, sectors});
+        return;
+    }
+
+    // [a, b) grown by one pixel and split at the texture edge: up to three pixel ranges.
+    struct Span {
+        int a;
+        int b;
+    };
+    auto grow = [](int a, int b, int size, Span* spans) {
+        int n = 0;
+        spans[n++] = {std::max(a - 1, 0), std::min(b + 1, size)};
+        if (a - 1 < 0) spans[n++] = {size - 1, size};
+        if (b + 1 > size) spans[n++] = {0, 1};
+        return n;
+    };
+
+    for (const DamageRect& r : dmg.rects) {
+        Span xs[3], ys[3];
+        int nx = grow(r.x, r.x + r.w, dmg.width, xs);
+        int ny = grow(r.y, r.y + r.h, dmg.height, ys);
+        for (int i = 0; i < nx; ++i) {
+            for (int j = 0; j < ny; ++j) {
+                double u0 = static_cast<double>(xs[i].a) / dmg.width;
+                double u1 = static_cast<double>(xs[i].b) / dmg.width;
+                double v0 = static_cast<double>(ys[j].a) / dmg.height;
+                double v1 = static_cast<double>(ys[j].b) / dmg.height;
+
+                SurfacePatch p;
+                p.sector0 = static_cast<int>(std::floor(u0 * sectors));
+                p.sector1 = static_cast<int>(std::ceil(u1 * sectors));
+                if (mode == ProjectionMode::Cylinder) {
+                    p.ring0 = static_cast<int>(std::floor(v0 * rings));
+                    p.ring1 = static_cast<int>(std::ceil(v1 * rings));
+                } else {
+                    p.ring0 = static_cast<int>(std::floor((1.0 - v1) * rings));
+                    p.ring1 = static_cast<int>(std::ceil((1.0 - v0) * rings));
+                }
+                p.sector0 = std::clamp(p.sector0, 0, sectors);
+                p.sector1 = std::clamp(p.sector1, 0, sectors);
+                p.ring0 = std::clamp(p.ring0, 0, rings);
+                p.ring1 = std::clamp(p.ring1, 0, rings);
+                if (p.sector1 > p.sector0 && p.ring1 > p.ring0) out.push_back(p);
+            }
+        }
+    }
+    mergeSurfacePatches(out);
+}
+
+// Position of mesh vertex (ring boundary r, sector boundary s); must match drawTextured*().
+static inline Vec3 surfaceVertex(ProjectionMode mode, float sphericity, float thetaMaxRad,
+                                 int r, int s, int rings, int sectors) {
+    const float PI = 3.14159265358979323846f;
+    const float radius = SPHERE_RADIUS;
+    float vr = static_cast<float>(r) / static_cast<float>(rings);
+    float phi = static_cast<float>(s) / static_cast<float>(sectors) * 2.0f * PI;
+
+    if (mode == ProjectionMode::Cylinder) {
+        float yMax = radius * (PI / 2.0f);
+        float y = yMax - 2.0f * yMax * vr;
+        return {radius * std::cos(phi), y, radius * std::sin(phi)};
+    }
+
+    float theta = (mode == ProjectionMode::SphereClamp)
+                      ? -thetaMaxRad + vr * (2.0f * thetaMaxRad)
+                      : vr * PI - PI / 2.0f;
+    Vec3 sp = {radius * std::cos(theta) * std::cos(phi), radius * std::sin(theta),
+               radius * std::cos(theta) * std::sin(phi)};
+    if (mode != ProjectionMode::Morph) return sp;
+
+    float k = clamp01(sphericity);
+    Vec3 cp = {radius * std::cos(phi), radius * theta, radius * std::sin(phi)};
+    return {(1.0f - k) * cp.x + k * sp.x, (1.0f - k) * cp.y + k * sp.y, (1.0f - k) * cp.z + k * sp.z};
+}
+
+// View-space rectangle in framebuffer pixels, GL origin (bottom-left), half-open.
+struct ViewRect {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+};
+
+static inline long long viewRectArea(const ViewRect& r) {
+    return static_cast<long long>(r.x1 - r.x0) * static_cast<long long>(r.y1 - r.y0);
+}
+
+// Bounding box of non-empty `rects`.
+static inline ViewRect viewRectBounds(const std::vector<ViewRect>& rects) {
+    ViewRect all = rects[0];
+    for (const ViewRect& v : rects) {
+        all = {std::min(all.x0, v.x0), std::min(all.y0, v.y0), std::max(all.x1, v.x1), std::max(all.y1, v.y1)};
+    }
+    return all;
+}
+
+// More view rects than this collapse into their bbox. The rects only bound the scissor and the
+// depth clear of a partial frame; what gets drawn are the surface patches behind them.
+static constexpr std::size_t MAX_VIEW_RECTS = 4;
+
+// Surface patches -> screen rectangles for the camera pose (same frustum as main(): near 0.1).
+// Every mesh vertex of a patch is projected, so the bbox is exact for the planar mesh quads.
+// A patch that crosses the camera plane makes the whole viewport dirty.
+static inline void surfacePatchesToViewRects(const std::vector<SurfacePatch>& patches, const RenderPose& pose,
+                                             float thetaMaxRad, int rings, int sectors, int fbW, int fbH,
+                                             std::vector<ViewRect>& out) {
+    static constexpr int MARGIN_PX = 2; // linear filtering / rasterization rounding
+
+    out.clear();
+    if (fbW <= 0 || fbH <= 0) return;
+
+    const float nearZ = 0.1f;
+    float tanHalfFovY = std::tan(pose.fovYDeg * 0.5f * 3.14159265358979323846f / 180.0f);
+    float aspect = static_cast<float>(fbW) / static_cast<float>(fbH);
+
+    for (const SurfacePatch& p : patches) {
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+        int inFront = 0, behind = 0;
+        for (int r = p.ring0; r <= p.ring1; ++r) {
+            for (int s = p.sector0; s <= p.sector1; ++s) {
+                Vec3 w = surfaceVertex(pose.mode, pose.sphericity, thetaMaxRad, r, s, rings, sectors);
+                // World -> camera: inverse of ndcToWorldDir()'s rotateY(rotateX(cam, pitch), yaw).
+                Vec3 c = rotateX(rotateY(w, -pose.yawDeg), -pose.pitchDeg);
+                if (c.z > -nearZ) {
+                    ++behind;
+                    continue;
+                }
+                ++inFront;
+                float ndcX = (c.x / -c.z) / (tanHalfFovY * aspect);
+                float ndcY = (c.y / -c.z) / tanHalfFovY;
+                minX = std::min(minX, ndcX);
+                maxX = std::max(maxX, ndcX);
+                minY = std::min(minY, ndcY);
+                maxY = std::max(maxY, ndcY);
+            }
+        }
+        if (inFront == 0) continue;
+        if (behind > 0) {
+            out.assign(1, {0, 0, fbW, fbH});
+            return;
+        }
+
+        ViewRect v;
+        v.x0 = std::max(0, static_cast<int>(std::floor((minX * 0.5f + 0.5f) * fbW)) - MARGIN_PX);
+        v.x1 = std::min(fbW, static_cast<int>(std::ceil((maxX * 0.5f + 0.5f) * fbW)) + MARGIN_PX);
+        v.y0 = std::max(0, static_cast<int>(std::floor((minY * 0.5f + 0.5f) * fbH)) - MARGIN_PX);
+        v.y1 = std::min(fbH, static_cast<int>(std::ceil((maxY * 0.5f + 0.5f) * fbH)) + MARGIN_PX);
+        if (v.x1 <= v.x0 || v.y1 <= v.y0) continue;
+
+        // Merge overlapping screen rects so no pixel is redrawn twice.
+        for (std::size_t i = 0; i < out.size();) {
+            const ViewRect& o = out[i];
+            if (o.x0 <= v.x1 && v.x0 <= o.x1 && o.y0 <= v.y1 && v.y0 <= o.y1) {
+                v = {std::min(o.x0, v.x0), std::min(o.y0, v.y0), std::max(o.x1, v.x1), std::max(o.y1, v.y1)};
+                out[i] = out.back();
+                out.pop_back();
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        out.push_back(v);
+    }
+
+    if (out.size() > MAX_VIEW_RECTS) out.assign(1, viewRectBounds(out));
+}
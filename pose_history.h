@@ -0,0 +1,96 @@
+// pose_history.h
+// История поз камеры для компенсации задержки вывода.
+// Клик через VNC приходит по кадру, который пользователь видел ~latency назад; если камера
+// в этот момент вращалась, текущие yaw/pitch уже другие и клик "промахивается".
+// Каждый показанный кадр кладёт сюда свою позу с моментом показа (после swap), а мышь
+// маппится через позу кадра, который был на экране в момент (событие - задержка вывода);
+// задержка = откалиброванная сквозная (rfb_loadgen input_p50) минус измеренная локальная часть.
+#pragma once
+
+#include "projection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+struct RenderPose {
+    std::uint64_t  frameId = 0;
+    std::int64_t   presentNs = 0;  // steady clock, when the frame finished swapping
+    float          yawDeg = 0.0f;
+    float          pitchDeg = 0.0f;
+    float          fovYDeg = 90.0f;
+    ProjectionMode mode = ProjectionMode::Sphere;
+    float          sphericity = 1.0f;
+};
+
+static inline std::int64_t poseClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fixed-size ring of recently presented poses. Written by the render loop and read by GLFW
+// input callbacks, which run on the same thread inside glfwPollEvents(), so no locking.
+class PoseHistory {
+public:
+    // ~4 s at 60 fps: far more than any sane VNC latency.
+    static constexpr std::size_t CAPACITY = 256;
+
+    void push(const RenderPose& pose) {
+        ring_[head_] = pose;
+        head_ = (head_ + 1) % CAPACITY;
+        if (count_ < CAPACITY) ++count_;
+    }
+
+    bool empty() const { return count_ == 0; }
+
+    const RenderPose& latest() const {
+        return ring_[(head_ + CAPACITY - 1) % CAPACITY];
+    }
+
+    // Pose of the frame that was on screen at atNs: the newest frame presented at or before it.
+    // Older than the whole history -> oldest known pose. Returns false only if empty.
+    bool poseAt(std::int64_t atNs, RenderPose& out) const {
+        if (count_ == 0) return false;
+        for (std::size_t k = 0; k < count_; ++k) {
+            const RenderPose& p = ring_[(head_ + CAPACITY - 1 - k) % CAPACITY];
+            if (p.presentNs <= atNs) {
+                out = p;
+                return true;
+            }
+        }
+        out = ring_[(head_ + CAPACITY - count_) % CAPACITY];
+        return true;
+    }
+
+private:
+    RenderPose  ring_[CAPACITY];
+    std::size_t head_ = 0;
+    std::size_t count_ = 0;
+};
+
+// Local part of the output latency, measured on every presented frame: from the glfwPollEvents()
+// that picked up input to the end of the swap that shows its result. A client's input round trip
+// (rfb_loadgen input_p50: key sent -> pan-sized update received) is this plus the VNC transport
+// in both directions, and the transport is exactly how far back a pointer event has to look.
+class OutputLatency {
+public:
+    void addFrame(std::int64_t pollNs, std::int64_t presentNs) {
+        std::int64_t d = std::max<std::int64_t>(0, presentNs - pollNs);
+        // EMA over ~8 frames: follows load changes, ignores a single slow swap.
+        localNs_ = (frames_ == 0) ? d : localNs_ + (d - localNs_) / 8;
+        ++frames_;
+    }
+
+    std::int64_t localNs() const { return localNs_; }
+
+    // Present time of the frame the client saw -> arrival of its event, given the calibrated
+    // end-to-end round trip.
+    std::int64_t lookbackNs(std::int64_t endToEndNs) const {
+        return std::max<std::int64_t>(0, endToEndNs - localNs_);
+    }
+
+private:
+    std::int64_t  localNs_ = 0;
+    std::uint64_t frames_ = 0;
+};
@@ -0,0 +1,174 @@
+// projection.h
+// Чистая математика проекций (без GL/X11): направление взгляда -> UV захваченного рабочего стола.
+// Используется и spherical_monitor, и headless-бенчмарками.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Sphere radius used both for rendering and mouse-ray mapping.
+static constexpr float SPHERE_RADIUS = 5.0f;
+
+enum class ProjectionMode {
+    Sphere,
+    SphereClamp,
+    Cylinder,
+    Morph
+};
+
+static inline const char* projectionModeName(ProjectionMode m) {
+    switch (m) {
+        case ProjectionMode::Sphere: return "sphere";
+        case ProjectionMode::SphereClamp: return "sphere_clamp";
+        case ProjectionMode::Cylinder: return "cylinder";
+        case ProjectionMode::Morph: return "morph";
+        default: return "sphere";
+    }
+}
+
+static inline float clamp01(float x) {
+    return std::clamp(x, 0.0f, 1.0f);
+}
+
+struct Vec3 {
+    float x;
+    float y;
+    float z;
+};
+
+static inline Vec3 normalize(Vec3 v) {
+    float len = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    if (len <= 0.0f) return {0.0f, 0.0f, -1.0f};
+    return {v.x / len, v.y / len, v.z / len};
+}
+
+static inline Vec3 rotateX(Vec3 v, float deg) {
+    float a = deg * 3.14159265358979323846f / 180.0f;
+    float c = std::cos(a);
+    float s = std::sin(a);
+    return {v.x, c * v.y - s * v.z, s * v.y + c * v.z};
+}
+
+static inline Vec3 rotateY(Vec3 v, float deg) {
+    float a = deg * 3.14159265358979323846f / 180.0f;
+    float c = std::cos(a);
+    float s = std::sin(a);
+    return {c * v.x + s * v.z, v.y, -s * v.x + c * v.z};
+}
+
+static inline bool dirToUV_Morph(Vec3 dirWorld, float sphericity, float& outU, float& outV) {
+    // Surface is a rotationally-symmetric morph between a cylinder and a sphere:
+    //   r(theta) = (1-s) * 1 + s * cos(theta)
+    //   y(theta) = (1-s) * theta + s * sin(theta)
+    // where theta in [-pi/2, pi/2], and final position is scaled by SPHERE_RADIUS.
+    // We solve for theta by intersecting the view ray with this surface in the (r,y) plane.
+
+    const float PI = 3.14159265358979323846f;
+    sphericity = clamp01(sphericity);
+
+    float dxz = std::sqrt(dirWorld.x * dirWorld.x + dirWorld.z * dirWorld.z);
+    if (dxz < 1e-6f) return false;
+
+    float phi = std::atan2(dirWorld.z, dirWorld.x);
+    if (phi < 0.0f) phi += 2.0f * PI;
+    outU = phi / (2.0f * PI);
+
+    auto f = [&](float theta) -> float {
+        float r = (1.0f - sphericity) * 1.0f + sphericity * std::cos(theta);
+        float y = (1.0f - sphericity) * theta + sphericity * std::sin(theta);
+        // Equation: dy * r(theta) = dxz * y(theta)
+        return dirWorld.y * r - dxz * y;
+    };
+
+    // Avoid exact poles where cos(theta)=0.
+    float lo = -PI / 2.0f + 1e-4f;
+    float hi =  PI / 2.0f - 1e-4f;
+    float flo = f(lo);
+    float fhi = f(hi);
+    if (flo == 0.0f) {
+        outV = 1.0f - ((lo + PI / 2.0f) / PI);
+        return true;
+    }
+    if (fhi == 0.0f) {
+        outV = 1.0f - ((hi + PI / 2.0f) / PI);
+        return true;
+    }
+    if ((flo > 0.0f && fhi > 0.0f) || (flo < 0.0f && fhi < 0.0f)) {
+        return false;
+    }
+
+    // Bisection.
+    for (int i = 0; i < 40; ++i) {
+        float mid = 0.5f * (lo + hi);
+        float fmid = f(mid);
+        if ((flo > 0.0f && fmid > 0.0f) || (flo < 0.0f && fmid < 0.0f)) {
+            lo = mid;
+            flo = fmid;
+        } else {
+            hi = mid;
+            fhi = fmid;
+        }
+    }
+
+    float theta = 0.5f * (lo + hi);
+    outV = 1.0f - ((theta + PI / 2.0f) / PI);
+    return true;
+}
+
+// World-space view direction -> normalized capture UV for the given projection.
+// thetaMaxRad is only used by SphereClamp, sphericity only by Morph.
+static inline bool dirToCaptureUV(ProjectionMode mode, float sphericity, float thetaMaxRad,
+                                  Vec3 dirWorld, float& u, float& v) {
+    const float PI = 3.14159265358979323846f;
+
+    if (mode == ProjectionMode::Morph) {
+        return dirToUV_Morph(dirWorld, sphericity, u, v);
+    }
+
+    if (mode == ProjectionMode::Cylinder) {
+        // Intersect ray with an infinite cylinder x^2+z^2=R^2 (camera at origin).
+        float dxz = std::sqrt(dirWorld.x * dirWorld.x + dirWorld.z * dirWorld.z);
+        if (dxz < 1e-6f) return false;
+        float t = SPHERE_RADIUS / dxz;
+        float px = dirWorld.x * t;
+        float py = dirWorld.y * t;
+        float pz = dirWorld.z * t;
+
+        float phi = std::atan2(pz, px); // [-pi, pi]
+        if (phi < 0.0f) phi += 2.0f * PI;
+        u = phi / (2.0f * PI);
+
+        // Map cylinder height linearly to the same theta range as the sphere's equirectangular V.
+        // y = R * theta, theta in [-pi/2, pi/2]
+        float theta = py / SPHERE_RADIUS;
+        if (theta < -PI / 2.0f || theta > PI / 2.0f) {
+            return false;
+        }
+        v = 1.0f - ((theta + PI / 2.0f) / PI);
+        return true;
+    }
+
+    // Sphere / sphere_clamp mapping.
+    float y = std::clamp(dirWorld.y, -1.0f, 1.0f);
+    float theta = std::asin(y); // [-pi/2, pi/2]
+
+    float phi = std::atan2(dirWorld.z, dirWorld.x); // [-pi, pi]
+    if (phi < 0.0f) phi += 2.0f * PI;
+    u = phi / (2.0f * PI);
+
+    if (mode == ProjectionMode::SphereClamp) {
+        if (theta < -thetaMaxRad || theta > thetaMaxRad) return false;
+        v = 1.0f - ((theta + thetaMaxRad) / (2.0f * thetaMaxRad));
+    } else {
+        v = 1.0f - ((theta + PI / 2.0f) / PI);
+    }
+    return true;
+}
+
+// NDC point (as seen on screen) -> world-space view direction for a camera at the origin
+// with the given yaw/pitch and vertical FOV. Mirrors the glFrustum/glRotatef setup in main().
+static inline Vec3 ndcToWorldDir(float ndcX, float ndcY, float aspect, float fovYDeg, float yawDeg, float pitchDeg) {
+    float tanHalfFovY = std::tan(fovYDeg * 0.5f * 3.14159265358979323846f / 180.0f);
+    Vec3 dirCam = normalize({ndcX * tanHalfFovY * aspect, ndcY * tanHalfFovY, -1.0f});
+    return normalize(rotateY(rotateX(dirCam, pitchDeg), yawDeg));
+}
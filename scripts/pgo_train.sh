@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+# PGO training run: executes the instrumented binaries on a headless scripted workload.
+#
+#   cmake --preset pgo-generate && cmake --build --preset pgo-generate
+#   scripts/pgo_train.sh build/pgo
+#   cmake --preset pgo-use && cmake --build --preset pgo-use
+#
+# spherical_monitor is trained under private Xvfb displays (SOURCE/VIEW like entrypoint.sh)
+# with SCRIPTED_FRAMES, so no real desktop or VNC client is needed. SOURCE runs the same
+# animated apps as entrypoint.sh, and the scripted camera holds still for half of each
+# phase, so the damage paths (sub-rect grab/upload, partial redraw, idle frames) are trained.
+set -euo pipefail
+
+BUILD_DIR=${1:-build/pgo}
+PGO_FRAMES=${PGO_FRAMES:-1200}
+PGO_SOURCE_DISPLAY=${PGO_SOURCE_DISPLAY:-:90}
+PGO_VIEW_DISPLAY=${PGO_VIEW_DISPLAY:-:91}
+PGO_VIRT_W=${PGO_VIRT_W:-3840}
+PGO_VIRT_H=${PGO_VIRT_H:-2160}
+
+XVFB_SOURCE_PID=""
+XVFB_VIEW_PID=""
+APP_PIDS=()
+
+cleanup() {
+	set +e
+	for p in "${APP_PIDS[@]}"; do kill "${p}" 2>/dev/null; done
+	for p in "${APP_PIDS[@]}"; do wait "${p}" 2>/dev/null; done
+	[[ -n "${XVFB_VIEW_PID}" ]] && kill "${XVFB_VIEW_PID}" 2>/dev/null
+	[[ -n "${XVFB_SOURCE_PID}" ]] && kill "${XVFB_SOURCE_PID}" 2>/dev/null
+	[[ -n "${XVFB_VIEW_PID}" ]] && wait "${XVFB_VIEW_PID}" 2>/dev/null
+	[[ -n "${XVFB_SOURCE_PID}" ]] && wait "${XVFB_SOURCE_PID}" 2>/dev/null
+}
+trap cleanup EXIT
+
+wait_for_x() {
+	local d="$1"
+	for i in $(seq 1 50); do
+		if xdpyinfo -display "${d}" >/dev/null 2>&1; then
+			return 0
+		fi
+		sleep 0.1
+	done
+	xdpyinfo -display "${d}" >/dev/null 2>&1
+}
+
+echo "PGO: bench_projection"
+"${BUILD_DIR}/bench_projection"
+
+if [[ -x "${BUILD_DIR}/spherical_monitor" ]]; then
+	echo "PGO: spherical_monitor (${PGO_FRAMES} scripted loop iterations)"
+	Xvfb "${PGO_SOURCE_DISPLAY}" -screen 0 "${PGO_VIRT_W}x${PGO_VIRT_H}x24" +extension GLX &
+	XVFB_SOURCE_PID=$!
+	Xvfb "${PGO_VIEW_DISPLAY}" -screen 0 "1280x720x24" +extension GLX &
+	XVFB_VIEW_PID=$!
+	wait_for_x "${PGO_SOURCE_DISPLAY}"
+	wait_for_x "${PGO_VIEW_DISPLAY}"
+
+	for app in xclock glxgears; do
+		if command -v "${app}" >/dev/null 2>&1; then
+			DISPLAY="${PGO_SOURCE_DISPLAY}" "${app}" >/dev/null 2>&1 &
+			APP_PIDS+=($!)
+		else
+			echo "PGO: ${app} not installed, SOURCE damage will be sparser" >&2
+		fi
+	done
+	sleep 1
+
+	DISPLAY="${PGO_VIEW_DISPLAY}" CAPTURE_DISPLAY="${PGO_SOURCE_DISPLAY}" SCRIPTED_FRAMES="${PGO_FRAMES}" \
+		"${BUILD_DIR}/spherical_monitor"
+else
+	echo "PGO: ${BUILD_DIR}/spherical_monitor not built, training headless targets only" >&2
+fi
+
+# Clang writes raw profiles that must be merged; GCC's .gcda files are used as-is.
+PGO_DIR="${BUILD_DIR}/pgo-profiles"
+if compgen -G "${PGO_DIR}/*.profraw" >/dev/null; then
+	llvm-profdata merge -output="${PGO_DIR}/default.profdata" "${PGO_DIR}"/*.profraw
+fi
+
+echo "PGO: training done, profiles in ${PGO_DIR}"
@@ -0,0 +1,80 @@
+#!/usr/bin/env bash
+# Viewer-scaling curve: runs rfb_loadgen with a growing number of viewers against the running
+# container and joins its client-side numbers with spherical_monitor's server-side
+# "Frame stats" log lines (FRAME_STATS_SEC) and CPU usage measured over the same window:
+# cpu_pct is the whole container (rfb_loadgen itself included), server_cpu_pct only the serving
+# side (Xvfb, spherical_monitor, x11vnc, websockify). 100 = one core.
+#
+#   docker compose up -d --build
+#   scripts/viewer_scaling.sh > scaling.csv
+#
+# Clients run inside the container against x11vnc directly (works with VNC_LOCALHOST_ONLY=1).
+# Set LOADGEN_URL=ws://127.0.0.1:6080/websockify to go through websockify like noVNC does.
+set -euo pipefail
+
+CONTAINER=${CONTAINER:-spherical-monitor}
+COUNTS=${COUNTS:-"1 2 4 8 16 32"}
+DURATION=${DURATION:-20}
+DRIVERS=${DRIVERS:-1}
+LOADGEN_URL=${LOADGEN_URL:-rfb://127.0.0.1:5900}
+
+# Prints "<container cgroup usec> <server processes usec> <wall usec>" from inside the container.
+cpu_snapshot() {
+	docker exec "${CONTAINER}" sh -c '
+		if [ -r /sys/fs/cgroup/cpu.stat ]; then
+			cg=$(awk "/^usage_usec/ { print \$2 }" /sys/fs/cgroup/cpu.stat)
+		else
+			cg=$(( $(cat /sys/fs/cgroup/cpuacct/cpuacct.usage) / 1000 ))
+		fi
+		ticks=0
+		for p in $(pidof Xvfb spherical_monitor x11vnc) $(pidof -x websockify); do
+			t=$(awk "{ print \$14 + \$15 }" "/proc/${p}/stat" 2>/dev/null || echo 0)
+			ticks=$((ticks + t))
+		done
+		echo "${cg} $((ticks * 1000000 / $(getconf CLK_TCK))) $(( $(date +%s%N) / 1000 ))"
+	'
+}
+
+echo "clients,fps_avg,fps_min,kbps_total,update_p50_ms,update_p95_ms,input_p50_ms,input_p95_ms,failed,server_fps,server_idle_fps,grab_ms,upload_ms,draw_ms,swap_ms,frame_max_ms,src_damage_pct,view_damage_pct,cpu_pct,server_cpu_pct"
+
+for n in ${COUNTS}; do
+	since=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+	cpu_before=$(cpu_snapshot)
+	# rfb_loadgen exits 1 when every client failed; the row still reports that in "failed",
+	# so the step is recorded instead of pipefail ending the whole sweep.
+	client=$(docker exec "${CONTAINER}" /app/rfb_loadgen --url "${LOADGEN_URL}" \
+		--clients "${n}" --drivers "${DRIVERS}" --duration "${DURATION}" --csv | tail -n 1) || true
+	if [[ -z "${client}" ]]; then
+		client="${n},,,,,,,,${n}"
+	fi
+	cpu_after=$(cpu_snapshot)
+	cpu=$(echo "${cpu_before} ${cpu_after}" | awk '{
+		wall = $6 - $3;
+		if (wall <= 0) { print ","; exit; }
+		printf "%.1f,%.1f", 100 * ($4 - $1) / wall, 100 * ($5 - $2) / wall;
+	}')
+
+	# Average every key=value field of the "Frame stats" / "Frame stats capture" lines logged during
+	# this step, per key since the two records carry different fields (matched in awk: no lines is a
+	# valid outcome with FRAME_STATS_SEC=0 or a short DURATION).
+	server=$(docker logs --since "${since}" "${CONTAINER}" 2>&1 | awk '
+		function avg(k) { return cnt[k] > 0 ? sum[k] / cnt[k] : 0; }
+		!/Frame stats/ { next }
+		{
+			for (i = 1; i <= NF; ++i) {
+				split($i, kv, "=");
+				if (kv[2] != "") { sum[kv[1]] += kv[2]; ++cnt[kv[1]]; }
+				if (kv[1] == "frame_max_ms" && kv[2] + 0 > max) { max = kv[2] + 0; }
+			}
+			++lines;
+		}
+		END {
+			if (lines == 0) { print ",,,,,,,,"; exit; }
+			printf "%.2f,%.2f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f", avg("fps"), avg("idle_fps"), avg("grab_ms"),
+				avg("upload_ms"), avg("draw_ms"), avg("swap_ms"), max,
+				avg("src_damage_pct"), avg("view_damage_pct");
+		}')
+
+	echo "${client},${server},${cpu}"
+done
@@ -1,15 +1,25 @@
 // spherical_monitor.cpp
+#define GLFW_INCLUDE_GLEXT
 #include <GLFW/glfw3.h>
 
+#include "async_log.h"
+#include "damage.h"
+#include "pose_history.h"
+#include "projection.h"
+
+#include <GL/glx.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
 
 #include <cmath>
-#include <iostream>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <chrono>
+#include <string>
 #include <vector>
 #include <algorithm>
 
@@ -22,16 +32,6 @@ float g_fovYDeg  = 90.0f;
 
 const float ROT_SPEED = 3.0f;   // скорость поворота стрелками
 
-// Sphere radius used both for rendering and mouse-ray mapping.
-static constexpr float SPHERE_RADIUS = 5.0f;
-
-enum class ProjectionMode {
-    Sphere,
-    SphereClamp,
-    Cylinder,
-    Morph
-};
-
 static ProjectionMode g_projectionMode = ProjectionMode::Sphere;
 
 // 0 = cylinder-like (less polar distortion), 1 = sphere-like.
@@ -44,20 +44,10 @@ static ProjectionMode parseProjectionModeFromEnv() {
     if (std::strcmp(v, "sphere_clamp") == 0) return ProjectionMode::SphereClamp;
     if (std::strcmp(v, "cylinder") == 0) return ProjectionMode::Cylinder;
     if (std::strcmp(v, "morph") == 0) return ProjectionMode::Morph;
-    std::cerr << "Unknown PROJECTION_MODE='" << v << "', using 'sphere'\n";
+    LOG_WARN("Unknown PROJECTION_MODE, using 'sphere'", {"value", v});
     return ProjectionMode::Sphere;
 }
 
-static const char* projectionModeName(ProjectionMode m) {
-    switch (m) {
-        case ProjectionMode::Sphere: return "sphere";
-        case ProjectionMode::SphereClamp: return "sphere_clamp";
-        case ProjectionMode::Cylinder: return "cylinder";
-        case ProjectionMode::Morph: return "morph";
-        default: return "sphere";
-    }
-}
-
 static float parseSphericityFromEnv() {
     float s = 1.0f;
     if (const char* v = std::getenv("SPHERICITY")) {
@@ -68,76 +58,7 @@ static float parseSphericityFromEnv() {
     return s;
 }
 
-static float clamp01(float x) {
-    return std::clamp(x, 0.0f, 1.0f);
-}
-
-struct Vec3 {
-    float x;
-    float y;
-    float z;
-};
-
-static bool dirToUV_Morph(Vec3 dirWorld, float sphericity, float& outU, float& outV) {
-    // Surface is a rotationally-symmetric morph between a cylinder and a sphere:
-    //   r(theta) = (1-s) * 1 + s * cos(theta)
-    //   y(theta) = (1-s) * theta + s * sin(theta)
-    // where theta in [-pi/2, pi/2], and final position is scaled by SPHERE_RADIUS.
-    // We solve for theta by intersecting the view ray with this surface in the (r,y) plane.
-
-    const float PI = 3.14159265358979323846f;
-    sphericity = clamp01(sphericity);
-
-    float dxz = std::sqrt(dirWorld.x * dirWorld.x + dirWorld.z * dirWorld.z);
-    if (dxz < 1e-6f) return false;
-
-    float phi = std::atan2(dirWorld.z, dirWorld.x);
-    if (phi < 0.0f) phi += 2.0f * PI;
-    outU = phi / (2.0f * PI);
-
-    auto f = [&](float theta) -> float {
-        float r = (1.0f - sphericity) * 1.0f + sphericity * std::cos(theta);
-        float y = (1.0f - sphericity) * theta + sphericity * std::sin(theta);
-        // Equation: dy * r(theta) = dxz * y(theta)
-        return dirWorld.y * r - dxz * y;
-    };
-
-    // Avoid exact poles where cos(theta)=0.
-    float lo = -PI / 2.0f + 1e-4f;
-    float hi =  PI / 2.0f - 1e-4f;
-    float flo = f(lo);
-    float fhi = f(hi);
-    if (flo == 0.0f) {
-        outV = 1.0f - ((lo + PI / 2.0f) / PI);
-        return true;
-    }
-    if (fhi == 0.0f) {
-        outV = 1.0f - ((hi + PI / 2.0f) / PI);
-        return true;
-    }
-    if ((flo > 0.0f && fhi > 0.0f) || (flo < 0.0f && fhi < 0.0f)) {
-        return false;
-    }
-
-    // Bisection.
-    for (int i = 0; i < 40; ++i) {
-        float mid = 0.5f * (lo + hi);
-        float fmid = f(mid);
-        if ((flo > 0.0f && fmid > 0.0f) || (flo < 0.0f && fmid < 0.0f)) {
-            lo = mid;
-            flo = fmid;
-        } else {
-            hi = mid;
-            fhi = fmid;
-        }
-    }
-
-    float theta = 0.5f * (lo + hi);
-    outV = 1.0f - ((theta + PI / 2.0f) / PI);
-    return true;
-}
-
-static float sphereClampThetaMaxRad() {
+static float parseSphereClampThetaMaxRad() {
     // Default: 80 degrees (removes polar singularity artifacts while keeping most of the sphere).
     float deg = 80.0f;
     if (const char* s = std::getenv("SPHERE_THETA_MAX_DEG")) {
@@ -151,35 +72,51 @@ static float sphereClampThetaMaxRad() {
     return deg * 3.14159265358979323846f / 180.0f;
 }
 
-static bool isSphereMouseEnabled() {
-    const char* v = std::getenv("SPHERE_MOUSE");
-    if (!v || std::strlen(v) == 0) return true;
-    return std::atoi(v) != 0;
+static float sphereClampThetaMaxRad() {
+    // Env is read once: this is called per frame and per mouse event.
+    static const float thetaMaxRad = parseSphereClampThetaMaxRad();
+    return thetaMaxRad;
 }
 
-struct WindowCapture;
+// SCRIPTED_FRAMES=N: headless scripted workload (camera sweep + projection cycling +
+// synthetic pointer mapping) for N loop iterations, then exit. Iterations where nothing visible
+// changed present no frame, so fewer than N frames are drawn. Used for PGO training and smoke
+// runs under Xvfb.
+static int parseScriptedFramesFromEnv() {
+    const char* v = std::getenv("SCRIPTED_FRAMES");
+    if (!v || std::strlen(v) == 0) return 0;
+    return std::max(0, std::atoi(v));
+}
 
-static Vec3 normalize(Vec3 v) {
-    float len = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
-    if (len <= 0.0f) return {0.0f, 0.0f, -1.0f};
-    return {v.x / len, v.y / len, v.z / len};
+// End-to-end input round trip of a VNC client, in ms: set it to rfb_loadgen's input_p50 for the
+// deployment (100 is a typical noVNC-over-LAN value). It cannot be observed from here; the local
+// poll->present part inside it is measured per frame (OutputLatency) and subtracted, what is left
+// is the transport both ways, i.e. how old the frame under the user's pointer is.
+static std::int64_t parsePointerLatencyNsFromEnv() {
+    int ms = 100;
+    if (const char* v = std::getenv("POINTER_LATENCY_MS")) {
+        if (std::strlen(v) > 0) ms = std::atoi(v);
+    }
+    return static_cast<std::int64_t>(std::clamp(ms, 0, 2000)) * 1000000;
 }
 
-static Vec3 rotateX(Vec3 v, float deg) {
-    float a = deg * 3.14159265358979323846f / 180.0f;
-    float c = std::cos(a);
-    float s = std::sin(a);
-    return {v.x, c * v.y - s * v.z, s * v.y + c * v.z};
+// DAMAGE_TRACKING=0 restores the old behaviour: full grab/upload and full redraw every frame.
+static bool isDamageTrackingEnabled() {
+    const char* v = std::getenv("DAMAGE_TRACKING");
+    if (!v || std::strlen(v) == 0) return true;
+    return std::atoi(v) != 0;
 }
 
-static Vec3 rotateY(Vec3 v, float deg) {
-    float a = deg * 3.14159265358979323846f / 180.0f;
-    float c = std::cos(a);
-    float s = std::sin(a);
-    return {c * v.x + s * v.z, v.y, -s * v.x + c * v.z};
+static bool isSphereMouseEnabled() {
+    const char* v = std::getenv("SPHERE_MOUSE");
+    if (!v || std::strlen(v) == 0) return true;
+    return std::atoi(v) != 0;
 }
 
-static bool viewMouseToCaptureXY(GLFWwindow* glfwWindow, const WindowCapture& cap, double xpos, double ypos, int& outX, int& outY);
+struct WindowCapture;
+
+static bool viewMouseToCaptureXY(GLFWwindow* glfwWindow, const WindowCapture& cap, const RenderPose& pose,
+                                 double xpos, double ypos, int& outX, int& outY);
 static bool captureLocalToRoot(const WindowCapture& cap, int local_x, int local_y, int& root_x, int& root_y);
 static void injectMouseMove(WindowCapture& cap, int local_x, int local_y);
 static void injectMouseButton(WindowCapture& cap, int button, bool down);
@@ -232,7 +169,9 @@ Window getTargetWindow(Display* dpy) {
     if (idStr && std::strlen(idStr) > 0) {
         unsigned long wid = std::strtoul(idStr, nullptr, 0); // поддерживает 0x...
         if (wid != 0) {
-            std::cerr << "Using window by ID: 0x" << std::hex << wid << std::dec << "\n";
+            char hex[24];
+            std::snprintf(hex, sizeof(hex), "0x%lx", wid);
+            LOG_INFO("Using window by ID", {"window", hex});
             return static_cast<Window>(wid);
         }
     }
@@ -240,18 +179,20 @@ Window getTargetWindow(Display* dpy) {
     // 2) если задано имя — ищем по части заголовка окна
     const char* name = std::getenv("TARGET_WINDOW_NAME");
     if (name && std::strlen(name) > 0) {
-        std::cerr << "Searching window by name fragment: \"" << name << "\"\n";
+        LOG_INFO("Searching window by name fragment", {"name", name});
         Window w = findWindowByNameRecursive(dpy, root, name);
         if (w) {
-            std::cerr << "Found window: 0x" << std::hex << (unsigned long)w << std::dec << "\n";
+            char hex[24];
+            std::snprintf(hex, sizeof(hex), "0x%lx", (unsigned long)w);
+            LOG_INFO("Found window", {"window", hex});
             return w;
         } else {
-            std::cerr << "Window with name fragment not found, fallback to root.\n";
+            LOG_WARN("Window with name fragment not found, fallback to root");
         }
     }
 
     // 3) fallback — весь root (как раньше)
-    std::cerr << "Using root window as source.\n";
+    LOG_INFO("Using root window as source");
     return root;
 }
 
@@ -268,6 +209,19 @@ struct WindowCapture {
     int      captureFps     = 0; // 0 = as fast as render loop
     std::chrono::steady_clock::time_point lastCapture = std::chrono::steady_clock::time_point::min();
     bool     loggedFirstCapture = false;
+    // Stage timings of the last updateTexture() call (0 if it skipped), for frame stats.
+    double   lastGrabMs   = 0.0;
+    double   lastUploadMs = 0.0;
+
+    // XDamage on the captured window: only changed rectangles are grabbed and uploaded.
+    Damage   xdamage = 0;
+    int      damageEventBase = 0;
+    bool     damagePending = true;  // a DamageNotify arrived since the last subtract
+    bool     needFullGrab  = true;  // first frame, resize or pixel format change
+    std::chrono::steady_clock::time_point lastFullGrab = std::chrono::steady_clock::now();
+    std::uint64_t damageSeq = 0;
+    // What the last updateTexture() changed in the texture, for downstream consumers.
+    DamageFrame damage;
 
     bool init() {
         // Capture source X server can be different from render X server (GLFW uses DISPLAY).
@@ -275,12 +229,12 @@ struct WindowCapture {
         const char* captureDisplayName = std::getenv("CAPTURE_DISPLAY");
         display = XOpenDisplay((captureDisplayName && std::strlen(captureDisplayName) > 0) ? captureDisplayName : nullptr);
         if (!display) {
-            std::cerr << "Failed to open X display\n";
+            LOG_ERROR("Failed to open X display");
             return false;
         }
 
         if (captureDisplayName && std::strlen(captureDisplayName) > 0) {
-            std::cerr << "Capturing from X display: " << captureDisplayName << "\n";
+            LOG_INFO("Capturing from X display", {"display", captureDisplayName});
         }
 
         window = getTargetWindow(display);
@@ -288,7 +242,7 @@ struct WindowCapture {
         // получаем размеры окна
         XWindowAttributes attr;
         if (!XGetWindowAttributes(display, window, &attr)) {
-            std::cerr << "XGetWindowAttributes failed, using default size.\n";
+            LOG_WARN("XGetWindowAttributes failed, using default size");
             width = 1024;
             height = 768;
         } else {
@@ -305,18 +259,13 @@ struct WindowCapture {
         GLint maxTexSize = 0;
         glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexSize);
         if (maxTexSize > 0 && (width > maxTexSize || height > maxTexSize)) {
-            std::cerr << "WARNING: capture size " << width << "x" << height
-                      << " exceeds GL_MAX_TEXTURE_SIZE=" << maxTexSize
-                      << ". Clamping capture to fit. Consider lowering VIRT_W/VIRT_H.\n";
+            LOG_WARN("Capture size exceeds GL_MAX_TEXTURE_SIZE, clamping. Consider lowering VIRT_W/VIRT_H",
+                     {"width", width}, {"height", height}, {"max_texture_size", maxTexSize});
             if (width > maxTexSize) width = maxTexSize;
             if (height > maxTexSize) height = maxTexSize;
         }
 
-        std::cerr << "Capture window size: " << width << "x" << height;
-        if (captureFps > 0) {
-            std::cerr << " (CAPTURE_FPS=" << captureFps << ")";
-        }
-        std::cerr << "\n";
+        LOG_INFO("Capture window size", {"width", width}, {"height", height}, {"capture_fps", captureFps});
 
         // Try to detect pixel format once.
         // Most X11 setups provide 32bpp (BGRA), but some provide 24bpp (BGR).
@@ -368,10 +317,25 @@ struct WindowCapture {
                      0, pixelFormat, GL_UNSIGNED_BYTE, fallback.data());
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        int damageErrorBase = 0;
+        if (!isDamageTrackingEnabled()) {
+            LOG_INFO("Damage tracking disabled, capturing full frames");
+        } else if (XDamageQueryExtension(display, &damageEventBase, &damageErrorBase)) {
+            // Same approach as x11vnc -xdamage: one damage object on the captured (root) window.
+            xdamage = XDamageCreate(display, window, XDamageReportNonEmpty);
+            LOG_INFO("Damage tracking enabled (XDamage)");
+        } else {
+            LOG_WARN("XDamage extension not available, capturing full frames");
+        }
         return true;
     }
 
     void shutdown() {
+        if (xdamage) {
+            XDamageDestroy(display, xdamage);
+            xdamage = 0;
+        }
         if (texId) {
             glDeleteTextures(1, &texId);
             texId = 0;
@@ -394,73 +358,163 @@ struct WindowCapture {
         if (attr.width != width || attr.height != height) {
             width = attr.width;
             height = attr.height;
-            std::cerr << "Window size changed: " << width << "x" << height << "\n";
+            LOG_INFO("Window size changed", {"width", width}, {"height", height});
+            needFullGrab = true;
             glBindTexture(GL_TEXTURE_2D, texId);
             glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height,
                          0, pixelFormat, GL_UNSIGNED_BYTE, nullptr);
         }
     }
 
-    void updateTexture() {
-        if (!display) return;
-
-        if (captureFps > 0) {
-            auto now = std::chrono::steady_clock::now();
-            auto minInterval = std::chrono::milliseconds(1000 / captureFps);
-            if (lastCapture != std::chrono::steady_clock::time_point::min() && (now - lastCapture) < minInterval) {
-                return;
-            }
-            lastCapture = now;
+    // Fills `damage` with what changed since the last call: full frame without XDamage,
+    // otherwise the region accumulated by the server (plus a periodic full safety grab).
+    void collectDamage() {
+        damage.reset(width, height);
+        if (!xdamage) {
+            damage.markFull();
+            return;
         }
 
-        // если окно свернули/скрыли, attr.map_state может быть IsUnmapped
-        updateSizeIfChanged();
+        while (XPending(display) > 0) {
+            XEvent ev;
+            XNextEvent(display, &ev);
+            if (ev.type == damageEventBase + XDamageNotify) damagePending = true;
+        }
 
-        if (width <= 0 || height <= 0) return;
+        auto now = std::chrono::steady_clock::now();
+        if (needFullGrab || (now - lastFullGrab) > std::chrono::seconds(5)) {
+            XDamageSubtract(display, xdamage, None, None);
+            damagePending = false;
+            damage.markFull();
+            return;
+        }
+        if (!damagePending) return;
+
+        XserverRegion region = XFixesCreateRegion(display, nullptr, 0);
+        XDamageSubtract(display, xdamage, None, region);
+        int n = 0;
+        XRectangle* rs = XFixesFetchRegion(display, region, &n);
+        for (int i = 0; i < n; ++i) {
+            damage.add({rs[i].x, rs[i].y, rs[i].width, rs[i].height});
+        }
+        if (rs) XFree(rs);
+        XFixesDestroyRegion(display, region);
+        damagePending = false;
+    }
 
+    // Grabs one source rectangle and uploads it into the same place of the texture.
+    bool grabAndUpload(const DamageRect& r) {
+        auto grabStart = std::chrono::steady_clock::now();
         XImage* img = XGetImage(display, window,
-                                0, 0, width, height,
+                                r.x, r.y, r.w, r.h,
                                 AllPlanes, ZPixmap);
+        auto grabEnd = std::chrono::steady_clock::now();
+        lastGrabMs += std::chrono::duration<double, std::milli>(grabEnd - grabStart).count();
         if (!img) {
-            static auto lastLog = std::chrono::steady_clock::time_point::min();
-            auto now = std::chrono::steady_clock::now();
-            if (lastLog == std::chrono::steady_clock::time_point::min() || (now - lastLog) > std::chrono::seconds(2)) {
-                std::cerr << "XGetImage failed\n";
-                lastLog = now;
-            }
-            return;
+            LOG_WARN_EVERY(2000, "XGetImage failed", {"x", r.x}, {"y", r.y}, {"width", r.w}, {"height", r.h});
+            return false;
         }
 
         if (!loggedFirstCapture) {
-            std::cerr << "First successful capture (bpp=" << img->bits_per_pixel << ")\n";
+            LOG_INFO("First successful capture", {"bpp", img->bits_per_pixel});
             loggedFirstCapture = true;
         }
 
-        // If format changes at runtime (rare), re-init texture.
+        // If format changes at runtime (rare), re-init texture and grab everything next time.
         if (img->bits_per_pixel == 24 && pixelFormat != GL_BGR) {
             pixelFormat = GL_BGR;
             internalFormat = GL_RGB;
             glBindTexture(GL_TEXTURE_2D, texId);
             glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, pixelFormat, GL_UNSIGNED_BYTE, nullptr);
+            needFullGrab = true;
         } else if (img->bits_per_pixel != 24 && pixelFormat != GL_BGRA) {
             pixelFormat = GL_BGRA;
             internalFormat = GL_RGBA;
             glBindTexture(GL_TEXTURE_2D, texId);
             glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, pixelFormat, GL_UNSIGNED_BYTE, nullptr);
+            needFullGrab = true;
         }
 
+        // Rows keep the server's padding (bitmap_pad), so describe the real stride to GL: either as
+        // a row length in whole pixels, or (24bpp with an odd width) as the padded row alignment.
+        // Anything else is uploaded row by row.
+        int bytesPerPixel = img->bits_per_pixel / 8;
+        int stride = img->bytes_per_line;
+        int padBytes = std::max(1, img->bitmap_pad / 8);
+        int packedRow = r.w * bytesPerPixel;
         glBindTexture(GL_TEXTURE_2D, texId);
+        if (bytesPerPixel > 0 && stride % bytesPerPixel == 0) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bytesPerPixel);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, pixelFormat, GL_UNSIGNED_BYTE, img->data);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        } else if (padBytes <= 8 && (packedRow + padBytes - 1) / padBytes * padBytes == stride) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, padBytes);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, pixelFormat, GL_UNSIGNED_BYTE, img->data);
+        } else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (int row = 0; row < r.h; ++row) {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y + row, r.w, 1, pixelFormat, GL_UNSIGNED_BYTE,
+                                img->data + static_cast<std::size_t>(row) * static_cast<std::size_t>(stride));
+            }
+        }
         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexSubImage2D(GL_TEXTURE_2D, 0,
-                        0, 0, width, height,
-                        pixelFormat, GL_UNSIGNED_BYTE,
-                        img->data);
 
         XDestroyImage(img);
+        lastUploadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - grabEnd).count();
+        return true;
+    }
+
+    void updateTexture() {
+        lastGrabMs = 0.0;
+        lastUploadMs = 0.0;
+        damage.reset(width, height);
+        if (!display) return;
+
+        if (captureFps > 0) {
+            auto now = std::chrono::steady_clock::now();
+            auto minInterval = std::chrono::milliseconds(1000 / captureFps);
+            if (lastCapture != std::chrono::steady_clock::time_point::min() && (now - lastCapture) < minInterval) {
+                return;
+            }
+            lastCapture = now;
+        }
+
+        // если окно свернули/скрыли, attr.map_state может быть IsUnmapped
+        updateSizeIfChanged();
+
+        if (width <= 0 || height <= 0) return;
+
+        collectDamage();
+        if (damage.empty()) return;
+        damage.seq = ++damageSeq;
+
+        if (damage.full) {
+            needFullGrab = false;
+            lastFullGrab = std::chrono::steady_clock::now();
+            if (!grabAndUpload({0, 0, width, height})) {
+                // Nothing reached the texture; retry the full grab next time.
+                needFullGrab = true;
+                damage.reset(width, height);
+            }
+            return;
+        }
+        // XDamageSubtract already cleared these on the server: a rect that failed to reach the
+        // texture is dropped from `damage` (nothing changed on screen) and recovered by a full grab.
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < damage.rects.size(); ++i) {
+            if (grabAndUpload(damage.rects[i])) {
+                damage.rects[kept++] = damage.rects[i];
+            } else {
+                needFullGrab = true;
+            }
+        }
+        damage.rects.resize(kept);
     }
 };
 
-static bool viewMouseToCaptureXY(GLFWwindow* glfwWindow, const WindowCapture& cap, double xpos, double ypos, int& outX, int& outY) {
+static bool viewMouseToCaptureXY(GLFWwindow* glfwWindow, const WindowCapture& cap, const RenderPose& pose,
+                                 double xpos, double ypos, int& outX, int& outY) {
     if (cap.width <= 0 || cap.height <= 0) return false;
 
     int winW = 0, winH = 0;
@@ -479,58 +533,13 @@ static bool viewMouseToCaptureXY(GLFWwindow* glfwWindow, const WindowCapture& ca
     float ndcX = static_cast<float>((2.0 * (mx + 0.5) / static_cast<double>(fbW)) - 1.0);
     float ndcY = static_cast<float>(1.0 - (2.0 * (my + 0.5) / static_cast<double>(fbH)));
 
-    // Reconstruct a view ray in camera space for the same projection used in rendering.
+    // Reconstruct a world-space view ray for the same projection used in rendering.
     float aspect = static_cast<float>(fbW) / static_cast<float>(fbH);
-    float tanHalfFovY = std::tan(g_fovYDeg * 0.5f * 3.14159265358979323846f / 180.0f);
-    Vec3 dirCam = normalize({ndcX * tanHalfFovY * aspect, ndcY * tanHalfFovY, -1.0f});
-
-    // Convert camera-space ray to world-space direction in the sphere's model coordinates.
-    Vec3 dirWorld = rotateY(rotateX(dirCam, g_pitchDeg), g_yawDeg);
-    dirWorld = normalize(dirWorld);
+    Vec3 dirWorld = ndcToWorldDir(ndcX, ndcY, aspect, pose.fovYDeg, pose.yawDeg, pose.pitchDeg);
 
     float u = 0.0f;
     float v = 0.0f;
-    const float PI = 3.14159265358979323846f;
-
-    if (g_projectionMode == ProjectionMode::Morph) {
-        if (!dirToUV_Morph(dirWorld, g_sphericity, u, v)) return false;
-    } else if (g_projectionMode == ProjectionMode::Cylinder) {
-        // Intersect ray with an infinite cylinder x^2+z^2=R^2 (camera at origin).
-        float dxz = std::sqrt(dirWorld.x * dirWorld.x + dirWorld.z * dirWorld.z);
-        if (dxz < 1e-6f) return false;
-        float t = SPHERE_RADIUS / dxz;
-        float px = dirWorld.x * t;
-        float py = dirWorld.y * t;
-        float pz = dirWorld.z * t;
-
-        float phi = std::atan2(pz, px); // [-pi, pi]
-        if (phi < 0.0f) phi += 2.0f * PI;
-        u = phi / (2.0f * PI);
-
-        // Map cylinder height linearly to the same theta range as the sphere's equirectangular V.
-        // y = R * theta, theta in [-pi/2, pi/2]
-        float theta = py / SPHERE_RADIUS;
-        if (theta < -PI / 2.0f || theta > PI / 2.0f) {
-            return false;
-        }
-        v = 1.0f - ((theta + PI / 2.0f) / PI);
-    } else {
-        // Sphere / sphere_clamp mapping.
-        float y = std::clamp(dirWorld.y, -1.0f, 1.0f);
-        float theta = std::asin(y); // [-pi/2, pi/2]
-
-        float phi = std::atan2(dirWorld.z, dirWorld.x); // [-pi, pi]
-        if (phi < 0.0f) phi += 2.0f * PI;
-        u = phi / (2.0f * PI);
-
-        if (g_projectionMode == ProjectionMode::SphereClamp) {
-            float tmax = sphereClampThetaMaxRad();
-            if (theta < -tmax || theta > tmax) return false;
-            v = 1.0f - ((theta + tmax) / (2.0f * tmax));
-        } else {
-            v = 1.0f - ((theta + PI / 2.0f) / PI);
-        }
-    }
+    if (!dirToCaptureUV(pose.mode, pose.sphericity, sphereClampThetaMaxRad(), dirWorld, u, v)) return false;
 
     int cx = static_cast<int>(u * static_cast<float>(cap.width));
     int cy = static_cast<int>(v * static_cast<float>(cap.height));
@@ -586,7 +595,7 @@ void sendCenterClick(WindowCapture& cap) {
                                cap.window, root,
                                win_x, win_y,
                                &root_x, &root_y, &child)) {
-        std::cerr << "XTranslateCoordinates failed\n";
+        LOG_WARN("XTranslateCoordinates failed");
         return;
     }
 
@@ -597,16 +606,16 @@ void sendCenterClick(WindowCapture& cap) {
     XTestFakeButtonEvent(cap.display, 1, False, CurrentTime);  // ЛКМ up
     XFlush(cap.display);
 
-    std::cerr << "Clicked window center at root coords: "
-              << root_x << "," << root_y << "\n";
+    LOG_INFO("Clicked window center", {"root_x", root_x}, {"root_y", root_y});
 }
 
 // ---------- отрисовка сферы с текстурой внутри ----------
+// Рисуются только ячейки меша из `cells` ({0, rings, 0, sectors} — вся поверхность).
 
-void drawTexturedSphere(float radius, int rings, int sectors) {
+void drawTexturedSphere(float radius, int rings, int sectors, const SurfacePatch& cells) {
     const float PI = 3.14159265358979323846f;
 
-    for (int r = 0; r < rings; ++r) {
+    for (int r = cells.ring0; r < cells.ring1; ++r) {
         float v1 = (float)r / (float)rings;
         float v2 = (float)(r + 1) / (float)rings;
 
@@ -614,7 +623,7 @@ void drawTexturedSphere(float radius, int rings, int sectors) {
         float theta2 = v2 * PI - PI / 2.0f;
 
         glBegin(GL_QUAD_STRIP);
-        for (int s = 0; s <= sectors; ++s) {
+        for (int s = cells.sector0; s <= cells.sector1; ++s) {
             float u = (float)s / (float)sectors;
             float phi = u * 2.0f * PI;           // 0..2pi
 
@@ -642,11 +651,11 @@ void drawTexturedSphere(float radius, int rings, int sectors) {
     }
 }
 
-void drawTexturedSphereClamped(float radius, float thetaMaxRad, int rings, int sectors) {
+void drawTexturedSphereClamped(float radius, float thetaMaxRad, int rings, int sectors, const SurfacePatch& cells) {
     const float PI = 3.14159265358979323846f;
     thetaMaxRad = std::clamp(thetaMaxRad, 0.01f, (PI / 2.0f) - 0.001f);
 
-    for (int r = 0; r < rings; ++r) {
+    for (int r = cells.ring0; r < cells.ring1; ++r) {
         float v1 = (float)r / (float)rings;
         float v2 = (float)(r + 1) / (float)rings;
 
@@ -654,7 +663,7 @@ void drawTexturedSphereClamped(float radius, float thetaMaxRad, int rings, int s
         float theta2 = -thetaMaxRad + v2 * (2.0f * thetaMaxRad);
 
         glBegin(GL_QUAD_STRIP);
-        for (int s = 0; s <= sectors; ++s) {
+        for (int s = cells.sector0; s <= cells.sector1; ++s) {
             float u = (float)s / (float)sectors;
             float phi = u * 2.0f * PI;
 
@@ -681,14 +690,14 @@ void drawTexturedSphereClamped(float radius, float thetaMaxRad, int rings, int s
     }
 }
 
-void drawTexturedCylinder(float radius, int rings, int sectors) {
+void drawTexturedCylinder(float radius, int rings, int sectors, const SurfacePatch& cells) {
     const float PI = 3.14159265358979323846f;
 
     // Match sphere equirectangular V range: theta in [-pi/2, pi/2] and y = R * theta.
     float yMin = -radius * (PI / 2.0f);
     float yMax =  radius * (PI / 2.0f);
 
-    for (int r = 0; r < rings; ++r) {
+    for (int r = cells.ring0; r < cells.ring1; ++r) {
         float v1 = (float)r / (float)rings;
         float v2 = (float)(r + 1) / (float)rings;
 
@@ -696,7 +705,7 @@ void drawTexturedCylinder(float radius, int rings, int sectors) {
         float y2 = yMax + (yMin - yMax) * v2;
 
         glBegin(GL_QUAD_STRIP);
-        for (int s = 0; s <= sectors; ++s) {
+        for (int s = cells.sector0; s <= cells.sector1; ++s) {
             float u = (float)s / (float)sectors;
             float phi = u * 2.0f * PI;
 
@@ -713,11 +722,11 @@ void drawTexturedCylinder(float radius, int rings, int sectors) {
     }
 }
 
-void drawTexturedMorph(float radius, float sphericity, int rings, int sectors) {
+void drawTexturedMorph(float radius, float sphericity, int rings, int sectors, const SurfacePatch& cells) {
     const float PI = 3.14159265358979323846f;
     sphericity = clamp01(sphericity);
 
-    for (int r = 0; r < rings; ++r) {
+    for (int r = cells.ring0; r < cells.ring1; ++r) {
         float v1 = (float)r / (float)rings;
         float v2 = (float)(r + 1) / (float)rings;
 
@@ -725,7 +734,7 @@ void drawTexturedMorph(float radius, float sphericity, int rings, int sectors) {
         float theta2 = v2 * PI - PI / 2.0f;
 
         glBegin(GL_QUAD_STRIP);
-        for (int s = 0; s <= sectors; ++s) {
+        for (int s = cells.sector0; s <= cells.sector1; ++s) {
             float u = (float)s / (float)sectors;
             float phi = u * 2.0f * PI;
 
@@ -771,6 +780,36 @@ static double g_lastCursorX = 0.0;
 static double g_lastCursorY = 0.0;
 static bool g_leftMouseDown = false;
 
+static PoseHistory g_poseHistory;
+static OutputLatency g_outputLatency;
+static std::int64_t g_pointerLatencyNs = 0; // calibrated end-to-end, see parsePointerLatencyNsFromEnv()
+
+static RenderPose currentPose() {
+    RenderPose p;
+    p.yawDeg = g_yawDeg;
+    p.pitchDeg = g_pitchDeg;
+    p.fovYDeg = g_fovYDeg;
+    p.mode = g_projectionMode;
+    p.sphericity = g_sphericity;
+    return p;
+}
+
+// Pose of the frame the VNC client was most likely looking at when it sent this event.
+static RenderPose pointerPose() {
+    RenderPose p = currentPose();
+    if (g_pointerLatencyNs <= 0 || g_poseHistory.empty()) return p;
+
+    std::int64_t now = poseClockNs();
+    if (!g_poseHistory.poseAt(now - g_outputLatency.lookbackNs(g_pointerLatencyNs), p)) return currentPose();
+    if (p.frameId != g_poseHistory.latest().frameId) {
+        LOG_INFO_EVERY(1000, "Pointer mapped through past pose",
+                       {"frame_id", p.frameId}, {"age_ms", (now - p.presentNs) / 1000000},
+                       {"local_ms", g_outputLatency.localNs() / 1000000},
+                       {"yaw_delta_deg", g_yawDeg - p.yawDeg}, {"pitch_delta_deg", g_pitchDeg - p.pitchDeg});
+    }
+    return p;
+}
+
 static void onCursorPos(GLFWwindow* w, double xpos, double ypos) {
     g_lastCursorX = xpos;
     g_lastCursorY = ypos;
@@ -782,7 +821,7 @@ static void onCursorPos(GLFWwindow* w, double xpos, double ypos) {
     if (!cap) return;
 
     int cx = 0, cy = 0;
-    if (!viewMouseToCaptureXY(w, *cap, xpos, ypos, cx, cy)) return;
+    if (!viewMouseToCaptureXY(w, *cap, pointerPose(), xpos, ypos, cx, cy)) return;
     injectMouseMove(*cap, cx, cy);
 }
 
@@ -800,7 +839,7 @@ static void onMouseButton(GLFWwindow* w, int button, int action, int /*mods*/) {
     g_lastCursorY = ypos;
 
     int cx = 0, cy = 0;
-    if (!viewMouseToCaptureXY(w, *cap, xpos, ypos, cx, cy)) {
+    if (!viewMouseToCaptureXY(w, *cap, pointerPose(), xpos, ypos, cx, cy)) {
         // Still update button state to avoid getting stuck.
         if (action == GLFW_PRESS) g_leftMouseDown = true;
         if (action == GLFW_RELEASE) g_leftMouseDown = false;
@@ -819,33 +858,397 @@ static void onMouseButton(GLFWwindow* w, int button, int action, int /*mods*/) {
     }
 }
 
+static constexpr int MESH_RINGS = 64;
+static constexpr int MESH_SECTORS = 128;
+
+// How long the loop sleeps when nothing changed. SOURCE damage does not wake GLFW (other
+// X display), so this bounds the extra latency of a desktop change on an idle camera.
+static constexpr double IDLE_WAIT_SEC = 0.008;
+
+// Camera + the given cells of the textured surface for the pose; the caller clears (and
+// scissors) the framebuffer.
+static void drawScene(const RenderPose& pose, int winW, int winH, GLuint texId,
+                      const std::vector<SurfacePatch>& cells) {
+    // проекция
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    float aspect = (float)winW / (float)winH;
+    float fovY = pose.fovYDeg;
+    float fH = std::tan(fovY / 360.0f * 3.14159265f) * 0.1f;
+    float fW = fH * aspect;
+    glFrustum(-fW, fW, -fH, fH, 0.1f, 100.0f);
+
+    // камера
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glRotatef(-pose.pitchDeg, 1.0f, 0.0f, 0.0f);
+    glRotatef(-pose.yawDeg,   0.0f, 1.0f, 0.0f);
+
+    // рисуем сферу с текстурой захваченного окна
+    glBindTexture(GL_TEXTURE_2D, texId);
+    for (const SurfacePatch& c : cells) {
+        if (pose.mode == ProjectionMode::Morph) {
+            drawTexturedMorph(SPHERE_RADIUS, pose.sphericity, MESH_RINGS, MESH_SECTORS, c);
+        } else if (pose.mode == ProjectionMode::Cylinder) {
+            drawTexturedCylinder(SPHERE_RADIUS, MESH_RINGS, MESH_SECTORS, c);
+        } else if (pose.mode == ProjectionMode::SphereClamp) {
+            drawTexturedSphereClamped(SPHERE_RADIUS, sphereClampThetaMaxRad(), MESH_RINGS, MESH_SECTORS, c);
+        } else {
+            drawTexturedSphere(SPHERE_RADIUS, MESH_RINGS, MESH_SECTORS, c);
+        }
+    }
+}
+
+static bool samePose(const RenderPose& a, const RenderPose& b) {
+    return a.yawDeg == b.yawDeg && a.pitchDeg == b.pitchDeg && a.fovYDeg == b.fovYDeg &&
+           a.mode == b.mode && a.sphericity == b.sphericity;
+}
+
+#ifndef GLX_BACK_BUFFER_AGE_EXT
+#define GLX_BACK_BUFFER_AGE_EXT 0x20F4
+#endif
+
+// Where a partial redraw (only the damaged surface patches, scissored to their view rects) goes
+// so that every pixel outside the view damage still shows the last presented frame, without
+// reading the front buffer back (on Xvfb/Mesa that is an XGetImage of the whole window):
+//  - BufferAge (GLX_EXT_buffer_age): the back buffer holds the frame from `age` swaps ago, so it
+//    is enough to also repaint what changed in the frames presented since then (those were partial
+//    frames of the same pose, so their patches still map to the same pixels);
+//  - SceneFbo: partial frames are drawn into an FBO that keeps the last frame and is blitted
+//    to the back buffer (a local copy, no X round trip); full redraws go straight to the back buffer;
+//  - FullOnly: every changed frame is a full redraw.
+struct PartialRedraw {
+    enum class Method { FullOnly, BufferAge, SceneFbo };
+
+    static constexpr std::size_t AGE_HISTORY = 4;  // presented frames remembered for BufferAge
+
+    struct Presented {
+        bool full = true;
+        std::vector<ViewRect> rects;
+        std::vector<SurfacePatch> patches;
+    };
+
+    Method method = Method::FullOnly;
+    Display* glxDisplay = nullptr;
+    std::vector<Presented> history; // newest first
+
+    GLuint fbo = 0;
+    GLuint colorRb = 0;
+    GLuint depthRb = 0;
+    int    fboW = 0;
+    int    fboH = 0;
+    bool   fboValid = false;  // holds the last presented frame
+    bool   fboBound = false;
+
+    PFNGLGENFRAMEBUFFERSPROC         genFramebuffers = nullptr;
+    PFNGLDELETEFRAMEBUFFERSPROC      deleteFramebuffers = nullptr;
+    PFNGLBINDFRAMEBUFFERPROC         bindFramebuffer = nullptr;
+    PFNGLFRAMEBUFFERRENDERBUFFERPROC framebufferRenderbuffer = nullptr;
+    PFNGLCHECKFRAMEBUFFERSTATUSPROC  checkFramebufferStatus = nullptr;
+    PFNGLGENRENDERBUFFERSPROC        genRenderbuffers = nullptr;
+    PFNGLDELETERENDERBUFFERSPROC     deleteRenderbuffers = nullptr;
+    PFNGLBINDRENDERBUFFERPROC        bindRenderbuffer = nullptr;
+    PFNGLRENDERBUFFERSTORAGEPROC     renderbufferStorage = nullptr;
+    PFNGLBLITFRAMEBUFFERPROC         blitFramebuffer = nullptr;
+
+    void init(GLFWwindow* window) {
+        glxDisplay = glXGetCurrentDisplay();
+        const char* glxExt = glxDisplay ? glXQueryExtensionsString(glxDisplay, DefaultScreen(glxDisplay)) : nullptr;
+        if (glxExt && hasExtension(glxExt, "GLX_EXT_buffer_age")) {
+            method = Method::BufferAge;
+            LOG_INFO("Partial redraw", {"method", "buffer_age"});
+            return;
+        }
+
+        if (glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR) >= 3 ||
+            glfwExtensionSupported("GL_ARB_framebuffer_object")) {
+            genFramebuffers = reinterpret_cast<PFNGLGENFRAMEBUFFERSPROC>(glfwGetProcAddress("glGenFramebuffers"));
+            deleteFramebuffers = reinterpret_cast<PFNGLDELETEFRAMEBUFFERSPROC>(glfwGetProcAddress("glDeleteFramebuffers"));
+            bindFramebuffer = reinterpret_cast<PFNGLBINDFRAMEBUFFERPROC>(glfwGetProcAddress("glBindFramebuffer"));
+            framebufferRenderbuffer = reinterpret_cast<PFNGLFRAMEBUFFERRENDERBUFFERPROC>(glfwGetProcAddress("glFramebufferRenderbuffer"));
+            checkFramebufferStatus = reinterpret_cast<PFNGLCHECKFRAMEBUFFERSTATUSPROC>(glfwGetProcAddress("glCheckFramebufferStatus"));
+            genRenderbuffers = reinterpret_cast<PFNGLGENRENDERBUFFERSPROC>(glfwGetProcAddress("glGenRenderbuffers"));
+            deleteRenderbuffers = reinterpret_cast<PFNGLDELETERENDERBUFFERSPROC>(glfwGetProcAddress("glDeleteRenderbuffers"));
+            bindRenderbuffer = reinterpret_cast<PFNGLBINDRENDERBUFFERPROC>(glfwGetProcAddress("glBindRenderbuffer"));
+            renderbufferStorage = reinterpret_cast<PFNGLRENDERBUFFERSTORAGEPROC>(glfwGetProcAddress("glRenderbufferStorage"));
+            blitFramebuffer = reinterpret_cast<PFNGLBLITFRAMEBUFFERPROC>(glfwGetProcAddress("glBlitFramebuffer"));
+            if (genFramebuffers && deleteFramebuffers && bindFramebuffer && framebufferRenderbuffer &&
+                checkFramebufferStatus && genRenderbuffers && deleteRenderbuffers && bindRenderbuffer &&
+                renderbufferStorage && blitFramebuffer) {
+                method = Method::SceneFbo;
+                LOG_INFO("Partial redraw", {"method", "scene_fbo"});
+                return;
+            }
+        }
+        LOG_WARN("Partial redraw unavailable (no GLX_EXT_buffer_age, no FBO), redrawing changed frames fully");
+    }
+
+    void shutdown() {
+        if (method != Method::SceneFbo) return;
+        if (fbo) deleteFramebuffers(1, &fbo);
+        if (colorRb) deleteRenderbuffers(1, &colorRb);
+        if (depthRb) deleteRenderbuffers(1, &depthRb);
+        fbo = colorRb = depthRb = 0;
+    }
+
+    // Called before drawing a frame that changed. `full` may be raised; `repaint` and `patches`
+    // start as this frame's view damage and surface patches and end as what to redraw (ignored
+    // if full). Binds the target.
+    void begin(bool& full, std::vector<ViewRect>& repaint, std::vector<SurfacePatch>& patches, int fbW, int fbH) {
+        if (method == Method::FullOnly) {
+            full = true;
+        } else if (method == Method::BufferAge && !full) {
+            unsigned int age = 0;
+            glXQueryDrawable(glxDisplay, glXGetCurrentDrawable(), GLX_BACK_BUFFER_AGE_EXT, &age);
+            // age 0 = undefined contents; age N = frame presented N swaps ago.
+            if (age == 0 || age - 1 > history.size()) {
+                full = true;
+            } else {
+                for (std::size_t k = 0; k + 1 < age && !full; ++k) {
+                    if (history[k].full) full = true;
+                    repaint.insert(repaint.end(), history[k].rects.begin(), history[k].rects.end());
+                    patches.insert(patches.end(), history[k].patches.begin(), history[k].patches.end());
+                }
+                if (!full) {
+                    mergeSurfacePatches(patches);
+                    if (repaint.size() > MAX_VIEW_RECTS) repaint.assign(1, viewRectBounds(repaint));
+                }
+            }
+        } else if (method == Method::SceneFbo) {
+            if (full) {
+                // Camera moves: draw straight into the back buffer, the FBO goes stale.
+                fboValid = false;
+                return;
+            }
+            if (!ensureFbo(fbW, fbH) || !fboValid) full = true;
+            if (method != Method::SceneFbo) return;
+            bindFramebuffer(GL_FRAMEBUFFER, fbo);
+            fboBound = true;
+        }
+    }
+
+    // Called after drawing, before the swap. `damage` and `patches` are what changed relative to
+    // the previous frame.
+    void end(bool full, const std::vector<ViewRect>& damage, const std::vector<SurfacePatch>& patches,
+             int fbW, int fbH) {
+        if (method == Method::BufferAge) {
+            Presented p;
+            p.full = full;
+            if (!full) {
+                p.rects = damage;
+                p.patches = patches;
+            }
+            history.insert(history.begin(), std::move(p));
+            if (history.size() > AGE_HISTORY) history.pop_back();
+        } else if (fboBound) {
+            bindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+            bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            blitFramebuffer(0, 0, fbW, fbH, 0, 0, fbW, fbH, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            bindFramebuffer(GL_FRAMEBUFFER, 0);
+            fboBound = false;
+            fboValid = true;
+        }
+    }
+
+private:
+    static bool hasExtension(const char* list, const char* name) {
+        std::size_t len = std::strlen(name);
+        for (const char* p = std::strstr(list, name); p; p = std::strstr(p + len, name)) {
+            if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+        }
+        return false;
+    }
+
+    bool ensureFbo(int w, int h) {
+        if (fbo && w == fboW && h == fboH) return true;
+        fboValid = false;
+        if (!fbo) {
+            genFramebuffers(1, &fbo);
+            genRenderbuffers(1, &colorRb);
+            genRenderbuffers(1, &depthRb);
+        }
+        bindRenderbuffer(GL_RENDERBUFFER, colorRb);
+        renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+        bindRenderbuffer(GL_RENDERBUFFER, depthRb);
+        renderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+        bindRenderbuffer(GL_RENDERBUFFER, 0);
+        bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRb);
+        framebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRb);
+        GLenum status = checkFramebufferStatus(GL_FRAMEBUFFER);
+        bindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_WARN("Scene FBO incomplete, redrawing changed frames fully", {"status", static_cast<int>(status)});
+            shutdown();
+            method = Method::FullOnly;
+            return false;
+        }
+        fboW = w;
+        fboH = h;
+        return true;
+    }
+};
+
+// Expose/resize: what is on screen can no longer be trusted, the next frame is drawn completely.
+static bool g_forceFullRedraw = true;
+
+static void onWindowRefresh(GLFWwindow* /*w*/) {
+    g_forceFullRedraw = true;
+}
+
+// Server-side per-stage timings, logged every FRAME_STATS_SEC ("Frame stats" for the render side,
+// "Frame stats capture" for grab/upload) so viewer-scaling runs (scripts/viewer_scaling.sh)
+// can line them up with client-side numbers from rfb_loadgen.
+// Every loop iteration captures; only iterations with visible changes draw and swap:
+//   fps / idle_fps          presented frames / iterations skipped because nothing visible changed
+//   grab_ms, upload_ms,
+//   src_damage_pct          averaged over all iterations
+//   draw_ms, swap_ms,
+//   view_damage_pct         averaged over presented frames (share of the view actually repainted)
+//   damage_seq_gaps         captured damage (DamageFrame::seq) the renderer never used: consumed
+//                           where a partial redraw maps it to the view or a full redraw shows it
+struct FrameStats {
+    double intervalSec = 5.0;
+    std::chrono::steady_clock::time_point windowStart = std::chrono::steady_clock::now();
+    int    iterations = 0;
+    int    frames = 0;
+    double grabMs = 0.0;
+    double uploadMs = 0.0;
+    double srcDamagePct = 0.0;
+    double drawMs = 0.0;
+    double swapMs = 0.0;
+    double frameMaxMs = 0.0;
+    double viewDamagePct = 0.0;
+    std::uint64_t damageSeqGaps = 0;
+    std::uint64_t lastDamageSeq = 0; // survives the interval reset
+
+    void addCapture(double grab, double upload, double srcDamage) {
+        ++iterations;
+        grabMs += grab;
+        uploadMs += upload;
+        srcDamagePct += srcDamage;
+    }
+
+    // The renderer looked at capture `seq`: each one must be seen exactly once, in order.
+    void consumeDamage(std::uint64_t seq) {
+        if (seq <= lastDamageSeq) {
+            LOG_WARN_EVERY(1000, "Damage consumed twice", {"seq", seq}, {"last_seq", lastDamageSeq});
+            return;
+        }
+        if (lastDamageSeq != 0) damageSeqGaps += seq - lastDamageSeq - 1;
+        lastDamageSeq = seq;
+    }
+
+    void addPresented(double frameMs, double draw, double swap, double viewDamage) {
+        ++frames;
+        drawMs += draw;
+        swapMs += swap;
+        viewDamagePct += viewDamage;
+        frameMaxMs = std::max(frameMaxMs, frameMs);
+    }
+
+    // Once per loop iteration, presented or not, so an idle scene still reports.
+    void tick() {
+        auto now = std::chrono::steady_clock::now();
+        double sec = std::chrono::duration<double>(now - windowStart).count();
+        if (intervalSec <= 0.0 || sec < intervalSec) return;
+
+        double it = static_cast<double>(std::max(1, iterations));
+        double n = static_cast<double>(std::max(1, frames));
+        // Two records (render side, capture side) keep each one within LogRecord::MAX_FIELDS.
+        LOG_INFO("Frame stats", {"fps", frames / sec}, {"idle_fps", (iterations - frames) / sec},
+                 {"draw_ms", drawMs / n}, {"swap_ms", swapMs / n}, {"frame_max_ms", frameMaxMs},
+                 {"view_damage_pct", viewDamagePct / n});
+        LOG_INFO("Frame stats capture", {"grab_ms", grabMs / it}, {"upload_ms", uploadMs / it},
+                 {"src_damage_pct", srcDamagePct / it}, {"damage_seq_gaps", damageSeqGaps});
+        FrameStats next{intervalSec, now};
+        next.lastDamageSeq = lastDamageSeq;
+        *this = next;
+    }
+};
+
+static double parseFrameStatsSecFromEnv() {
+    const char* v = std::getenv("FRAME_STATS_SEC");
+    if (!v || std::strlen(v) == 0) return 5.0;
+    return std::max(0.0, std::atof(v));
+}
+
+static void logProjectionMode(const char* msg) {
+    const char* name = projectionModeName(g_projectionMode);
+    if (g_projectionMode == ProjectionMode::SphereClamp) {
+        LOG_INFO(msg, {"mode", name}, {"theta_max_deg", sphereClampThetaMaxRad() * 180.0f / 3.14159265358979323846f});
+    } else if (g_projectionMode == ProjectionMode::Morph) {
+        LOG_INFO(msg, {"mode", name}, {"sphericity", g_sphericity});
+    } else {
+        LOG_INFO(msg, {"mode", name});
+    }
+}
+
+// One step of the SCRIPTED_FRAMES workload: drives the same state the keyboard would and
+// exercises the pointer mapping path without injecting events into the SOURCE display.
+// Each projection mode gets a quarter of the run: the camera sweeps during the first half and
+// holds still during the second, so damage-driven partial redraws and idle frames run too.
+static void runScriptedStep(GLFWwindow* window, const WindowCapture& cap, int frame, int totalFrames) {
+    int total = std::max(1, totalFrames);
+    int phase = (frame * 4) / total;
+    bool holdCamera = ((frame * 4) % total) * 2 >= total;
+
+    ProjectionMode modes[] = {ProjectionMode::Sphere, ProjectionMode::SphereClamp,
+                              ProjectionMode::Cylinder, ProjectionMode::Morph};
+    ProjectionMode mode = modes[std::clamp(phase, 0, 3)];
+    if (mode != g_projectionMode) {
+        g_projectionMode = mode;
+        logProjectionMode("Projection mode switched");
+    }
+
+    if (!holdCamera) {
+        g_yawDeg += ROT_SPEED;
+        g_pitchDeg = 60.0f * std::sin(static_cast<float>(frame) * 0.02f);
+        g_fovYDeg = 75.0f + 30.0f * std::sin(static_cast<float>(frame) * 0.013f);
+        if (g_projectionMode == ProjectionMode::Morph) {
+            g_sphericity = 0.5f + 0.5f * std::sin(static_cast<float>(frame) * 0.05f);
+        }
+    }
+
+    int winW = 0, winH = 0;
+    glfwGetWindowSize(window, &winW, &winH);
+    RenderPose pose = pointerPose();
+    for (int gy = 0; gy < 8; ++gy) {
+        for (int gx = 0; gx < 8; ++gx) {
+            int cx = 0, cy = 0;
+            viewMouseToCaptureXY(window, cap, pose, (gx + 0.5) * winW / 8.0, (gy + 0.5) * winH / 8.0, cx, cy);
+        }
+    }
+}
+
 int main() {
+    // Все диагностические сообщения идут через фоновый поток (см. async_log.h).
+    AsyncLogScope logScope;
+
     if (!glfwInit()) {
-        std::cerr << "Failed to init GLFW\n";
+        LOG_ERROR("Failed to init GLFW");
         return 1;
     }
 
     g_projectionMode = parseProjectionModeFromEnv();
     g_sphericity = parseSphericityFromEnv();
-    std::cerr << "Projection mode: " << projectionModeName(g_projectionMode);
-    if (g_projectionMode == ProjectionMode::SphereClamp) {
-        std::cerr << " (SPHERE_THETA_MAX_DEG=" << (sphereClampThetaMaxRad() * 180.0f / 3.14159265358979323846f) << ")";
-    }
-    if (g_projectionMode == ProjectionMode::Morph) {
-        std::cerr << " (SPHERICITY=" << g_sphericity << ")";
-    }
-    std::cerr << "\n";
+    logProjectionMode("Projection mode");
+    g_pointerLatencyNs = parsePointerLatencyNsFromEnv();
+    LOG_INFO("Pointer latency compensation", {"end_to_end_latency_ms", g_pointerLatencyNs / 1000000});
 
     GLFWwindow* window = glfwCreateWindow(1280, 720,
                                           "Spherical Monitor (Window Capture)",
                                           nullptr, nullptr);
     if (!window) {
-        std::cerr << "Failed to create GLFW window\n";
+        LOG_ERROR("Failed to create GLFW window");
         glfwTerminate();
         return 1;
     }
     glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+
+    int scriptedFrames = parseScriptedFramesFromEnv();
+    // Scripted runs measure/train the render path, so they are not throttled by vsync.
+    glfwSwapInterval(scriptedFrames > 0 ? 0 : 1);
 
     glEnable(GL_TEXTURE_2D);
     glEnable(GL_DEPTH_TEST);
@@ -853,7 +1256,7 @@ int main() {
 
     WindowCapture cap;
     if (!cap.init()) {
-        std::cerr << "Window capture init failed\n";
+        LOG_ERROR("Window capture init failed");
         glfwDestroyWindow(window);
         glfwTerminate();
         return 1;
@@ -862,8 +1265,36 @@ int main() {
     glfwSetWindowUserPointer(window, &cap);
     glfwSetCursorPosCallback(window, onCursorPos);
     glfwSetMouseButtonCallback(window, onMouseButton);
+    glfwSetWindowRefreshCallback(window, onWindowRefresh);
+
+    PartialRedraw partialRedraw;
+    if (cap.xdamage) partialRedraw.init(window);
+
+    int frameIndex = 0;
+    int scriptedStep = 0;
+    FrameStats frameStats;
+    frameStats.intervalSec = parseFrameStatsSecFromEnv();
+
+    bool havePresented = false;
+    RenderPose lastPresented;
+    int lastFbW = 0, lastFbH = 0;
+    std::vector<SurfacePatch> surfacePatches;
+    std::vector<ViewRect> viewRects;
+    std::vector<ViewRect> repaintRects;
+    std::vector<SurfacePatch> repaintPatches;
+    const std::vector<SurfacePatch> wholeSurface = {{0, MESH_RINGS, 0, MESH_SECTORS}};
+    auto loopStart = std::chrono::steady_clock::now();
 
     while (!glfwWindowShouldClose(window)) {
+        frameStats.tick();
+        if (scriptedFrames > 0 && scriptedStep >= scriptedFrames) {
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+            LOG_INFO("Scripted workload done", {"steps", scriptedStep}, {"frames", frameIndex}, {"seconds", sec},
+                     {"fps", sec > 0.0 ? frameIndex / sec : 0.0});
+            break;
+        }
+
+        std::int64_t pollNs = poseClockNs();
         glfwPollEvents();
 
         // управление камерой стрелками
@@ -898,12 +1329,12 @@ int main() {
         if (wDown && !wWasDown) {
             g_projectionMode = ProjectionMode::Morph;
             g_sphericity = clamp01(g_sphericity + 0.1f);
-            std::cerr << "Morph sphericity: " << g_sphericity << "\n";
+            LOG_INFO("Morph sphericity", {"sphericity", g_sphericity});
         }
         if (sDown && !sWasDown) {
             g_projectionMode = ProjectionMode::Morph;
             g_sphericity = clamp01(g_sphericity - 0.1f);
-            std::cerr << "Morph sphericity: " << g_sphericity << "\n";
+            LOG_INFO("Morph sphericity", {"sphericity", g_sphericity});
         }
         wWasDown = wDown;
         sWasDown = sDown;
@@ -916,12 +1347,12 @@ int main() {
         if (qDown && !qWasDown) {
             g_fovYDeg -= 5.0f;
             if (g_fovYDeg < 30.0f) g_fovYDeg = 30.0f;
-            std::cerr << "FOV: " << g_fovYDeg << "\n";
+            LOG_INFO("FOV", {"fov_deg", g_fovYDeg});
         }
         if (eDown && !eWasDown) {
             g_fovYDeg += 5.0f;
             if (g_fovYDeg > 120.0f) g_fovYDeg = 120.0f;
-            std::cerr << "FOV: " << g_fovYDeg << "\n";
+            LOG_INFO("FOV", {"fov_deg", g_fovYDeg});
         }
         qWasDown = qDown;
         eWasDown = eDown;
@@ -939,57 +1370,103 @@ int main() {
             } else {
                 g_projectionMode = ProjectionMode::Sphere;
             }
-            std::cerr << "Projection mode switched to: " << projectionModeName(g_projectionMode);
-            if (g_projectionMode == ProjectionMode::SphereClamp) {
-                std::cerr << " (SPHERE_THETA_MAX_DEG=" << (sphereClampThetaMaxRad() * 180.0f / 3.14159265358979323846f) << ")";
-            }
-            if (g_projectionMode == ProjectionMode::Morph) {
-                std::cerr << " (SPHERICITY=" << g_sphericity << ")";
-            }
-            std::cerr << "\n";
+            logProjectionMode("Projection mode switched");
         }
         pWasDown = pDown;
 
+        if (scriptedFrames > 0) {
+            runScriptedStep(window, cap, scriptedStep++, scriptedFrames);
+        }
+
         // обновляем текстуру окна
         cap.updateTexture();
+        double srcPx = static_cast<double>(std::max(1, cap.width)) * std::max(1, cap.height);
+        frameStats.addCapture(cap.lastGrabMs, cap.lastUploadMs, 100.0 * static_cast<double>(cap.damage.area()) / srcPx);
 
+        auto drawStart = std::chrono::steady_clock::now();
         int winW, winH;
         glfwGetFramebufferSize(window, &winW, &winH);
-        glViewport(0, 0, winW, winH);
 
+        // Снимок позы кадра: рисуем именно её и её же кладём в историю для маппинга мыши.
+        RenderPose framePose = currentPose();
+        framePose.frameId = static_cast<std::uint64_t>(frameIndex);
+
+        // Рендер как потребитель damage-модели: если камера не двигалась, перерисовываются только
+        // экранные прямоугольники, куда попали изменившиеся части текстуры; если ничего не
+        // изменилось — кадр (и swap, а значит и работа x11vnc) пропускается.
+        bool fullRedraw = !cap.xdamage || !havePresented || g_forceFullRedraw ||
+                          !samePose(framePose, lastPresented) || winW != lastFbW || winH != lastFbH;
+        viewRects.clear();
+        surfacePatches.clear();
+        if (!fullRedraw) {
+            if (!cap.damage.empty()) {
+                damageToSurfacePatches(framePose.mode, cap.damage, MESH_RINGS, MESH_SECTORS, surfacePatches);
+                surfacePatchesToViewRects(surfacePatches, framePose, sphereClampThetaMaxRad(),
+                                          MESH_RINGS, MESH_SECTORS, winW, winH, viewRects);
+                // Consumed even if nothing of it is visible: the renderer looked and decided.
+                frameStats.consumeDamage(cap.damage.seq);
+            }
+            if (viewRects.empty()) {
+                glfwWaitEventsTimeout(IDLE_WAIT_SEC);
+                continue;
+            }
+            if (viewRects.size() == 1 && viewRectArea(viewRects[0]) == static_cast<long long>(winW) * winH) {
+                fullRedraw = true;
+            }
+        }
+
+        // Partial frames also repaint whatever the back buffer is missing (see PartialRedraw).
+        repaintRects = viewRects;
+        repaintPatches = surfacePatches;
+        partialRedraw.begin(fullRedraw, repaintRects, repaintPatches, winW, winH);
+
+        glViewport(0, 0, winW, winH);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // проекция
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        float aspect = (float)winW / (float)winH;
-        float fovY = g_fovYDeg;
-        float fH = std::tan(fovY / 360.0f * 3.14159265f) * 0.1f;
-        float fW = fH * aspect;
-        glFrustum(-fW, fW, -fH, fH, 0.1f, 100.0f);
-
-        // камера
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        glRotatef(-g_pitchDeg, 1.0f, 0.0f, 0.0f);
-        glRotatef(-g_yawDeg,   0.0f, 1.0f, 0.0f);
-
-        // рисуем сферу с текстурой захваченного окна
-        glBindTexture(GL_TEXTURE_2D, cap.texId);
-        if (g_projectionMode == ProjectionMode::Morph) {
-            drawTexturedMorph(SPHERE_RADIUS, g_sphericity, 64, 128);
-        } else if (g_projectionMode == ProjectionMode::Cylinder) {
-            drawTexturedCylinder(SPHERE_RADIUS, 64, 128);
-        } else if (g_projectionMode == ProjectionMode::SphereClamp) {
-            drawTexturedSphereClamped(SPHERE_RADIUS, sphereClampThetaMaxRad(), 64, 128);
+
+        long long viewDamagedPx = static_cast<long long>(winW) * winH;
+        if (fullRedraw) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawScene(framePose, winW, winH, cap.texId, wholeSurface);
+            // The whole texture went to the screen, this capture's damage included.
+            if (!cap.damage.empty()) frameStats.consumeDamage(cap.damage.seq);
         } else {
-            drawTexturedSphere(SPHERE_RADIUS, 64, 128);
+            // Камера внутри поверхности, сама себя она не заслоняет: достаточно перерисовать только
+            // повреждённые ячейки поверх прошлого кадра, без очистки цвета, одной отправкой под
+            // одним scissor (bbox view rects), очищая в нём лишь глубину.
+            viewDamagedPx = 0;
+            for (const ViewRect& v : repaintRects) viewDamagedPx += viewRectArea(v);
+            viewDamagedPx = std::min(viewDamagedPx, static_cast<long long>(winW) * winH);
+            ViewRect box = viewRectBounds(repaintRects);
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(box.x0, box.y0, box.x1 - box.x0, box.y1 - box.y0);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawScene(framePose, winW, winH, cap.texId, repaintPatches);
+            glDisable(GL_SCISSOR_TEST);
         }
+        partialRedraw.end(fullRedraw, viewRects, surfacePatches, winW, winH);
 
+        auto swapStart = std::chrono::steady_clock::now();
         glfwSwapBuffers(window);
+        auto swapEnd = std::chrono::steady_clock::now();
+        double drawMs = std::chrono::duration<double, std::milli>(swapStart - drawStart).count();
+        double swapMs = std::chrono::duration<double, std::milli>(swapEnd - swapStart).count();
+        frameStats.addPresented(cap.lastGrabMs + cap.lastUploadMs + drawMs + swapMs, drawMs, swapMs,
+                                100.0 * static_cast<double>(viewDamagedPx) / (static_cast<double>(std::max(1, winW)) * std::max(1, winH)));
+        g_forceFullRedraw = false;
+        havePresented = true;
+        lastPresented = framePose;
+        lastFbW = winW;
+        lastFbH = winH;
+
+        // Время показа измеряется после swap; poll -> present — локальная часть задержки вывода.
+        framePose.presentNs = poseClockNs();
+        g_poseHistory.push(framePose);
+        g_outputLatency.addFrame(pollNs, framePose.presentNs);
+
+        ++frameIndex;
     }
 
+    partialRedraw.shutdown();
     cap.shutdown();
     glfwDestroyWindow(window);
     glfwTerminate();
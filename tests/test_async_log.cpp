@@ -0,0 +1,78 @@
+// test_async_log.cpp
+// Проверки лога без фонового потока: rate limit LogSite, упаковка полей записи, вызовы LOG_* с разным числом полей.
+
+#include "async_log.h"
+#include "test_check.h"
+
+#include <string>
+
+namespace {
+
+void testLogSiteSuppression() {
+    const std::int64_t ms = 1000000;
+    LogSite site(100);
+    std::uint32_t suppressed = 12345;
+
+    CHECK(site.admit(0, suppressed));
+    CHECK(suppressed == 0);
+    CHECK(!site.admit(50 * ms, suppressed));
+    CHECK(!site.admit(99 * ms, suppressed));
+    // Interval elapsed: admitted, and reports the two swallowed records exactly once.
+    CHECK(site.admit(100 * ms, suppressed));
+    CHECK(suppressed == 2);
+    CHECK(!site.admit(150 * ms, suppressed));
+    CHECK(site.admit(250 * ms, suppressed));
+    CHECK(suppressed == 1);
+    CHECK(site.admit(400 * ms, suppressed));
+    CHECK(suppressed == 0);
+
+    // No interval: everything passes, nothing is counted.
+    LogSite unlimited(0);
+    for (int i = 0; i < 5; ++i) {
+        CHECK(unlimited.admit(0, suppressed));
+        CHECK(suppressed == 0);
+    }
+}
+
+void testLogFieldValues() {
+    LogField i("n", -42);
+    CHECK(i.type == LogField::Type::Int && i.i == -42);
+    LogField u("big", 5000000000ULL);
+    CHECK(u.type == LogField::Type::Int && u.i == 5000000000LL);
+    LogField b("flag", true);
+    CHECK(b.type == LogField::Type::Int && b.i == 1);
+    LogField f("ms", 2.5);
+    CHECK(f.type == LogField::Type::Float && f.f == 2.5);
+
+    LogField s("name", "xclock");
+    CHECK(s.type == LogField::Type::Str && std::string(s.s) == "xclock");
+    LogField null("name", static_cast<const char*>(nullptr));
+    CHECK(null.type == LogField::Type::Str && null.s[0] == '\0');
+
+    // Longer strings are cut to STR_LEN - 1 characters and stay terminated.
+    std::string longValue(LogField::STR_LEN * 2, 'x');
+    LogField cut("long", longValue);
+    CHECK(std::string(cut.s) == std::string(LogField::STR_LEN - 1, 'x'));
+
+    // Values share storage; a record stays a few hundred bytes even at MAX_FIELDS.
+    CHECK(sizeof(LogField) <= 64);
+    CHECK(sizeof(LogRecord) <= 512);
+}
+
+void testLogMacros() {
+    // Both overloads of logPush: no fields and exactly MAX_FIELDS (more does not compile).
+    // The writer thread is not started; stop() drains the records to stderr.
+    LOG_INFO("test_async_log no fields");
+    LOG_WARN_EVERY(1000, "test_async_log max fields", {"a", 1}, {"b", 2.0}, {"c", "three"}, {"d", 4u},
+                   {"e", 5LL}, {"f", false});
+    AsyncLog::instance().stop();
+}
+
+} // namespace
+
+int main() {
+    testLogSiteSuppression();
+    testLogFieldValues();
+    testLogMacros();
+    return testResult("test_async_log");
+}
@@ -0,0 +1,36 @@
+// test_check.h
+// Минимальные проверки для tests/* без фреймворка: ошибки считаются, main() возвращает testResult().
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+static int g_testFailures = 0;
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_testFailures;                                                         \
+        }                                                                             \
+    } while (0)
+
+#define CHECK_NEAR(a, b, eps)                                                         \
+    do {                                                                              \
+        double checkA_ = static_cast<double>(a);                                      \
+        double checkB_ = static_cast<double>(b);                                      \
+        if (!(std::fabs(checkA_ - checkB_) <= (eps))) {                               \
+            std::fprintf(stderr, "%s:%d: CHECK_NEAR failed: %s=%g %s=%g\n",           \
+                         __FILE__, __LINE__, #a, checkA_, #b, checkB_);               \
+            ++g_testFailures;                                                         \
+        }                                                                             \
+    } while (0)
+
+static inline int testResult(const char* name) {
+    if (g_testFailures > 0) {
+        std::fprintf(stderr, "%s: %d check(s) failed\n", name, g_testFailures);
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
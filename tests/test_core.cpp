@@ -0,0 +1,91 @@
+// test_core.cpp
+// Проверки чистой логики без GL/X11: проекции (экран -> UV и обратно).
+
+#include "projection.h"
+#include "test_check.h"
+
+namespace {
+
+const float PI = 3.14159265358979323846f;
+
+// Point of the projection surface at capture UV; inverse of dirToCaptureUV() for each mode.
+Vec3 surfacePointAtUV(ProjectionMode mode, float sphericity, float thetaMaxRad, float u, float v) {
+    float phi = u * 2.0f * PI;
+    float theta = (mode == ProjectionMode::SphereClamp) ? (1.0f - v) * 2.0f * thetaMaxRad - thetaMaxRad
+                                                        : (1.0f - v) * PI - PI / 2.0f;
+    if (mode == ProjectionMode::Cylinder) {
+        return {std::cos(phi), theta, std::sin(phi)};
+    }
+    if (mode == ProjectionMode::Morph) {
+        float r = (1.0f - sphericity) + sphericity * std::cos(theta);
+        float y = (1.0f - sphericity) * theta + sphericity * std::sin(theta);
+        return {r * std::cos(phi), y, r * std::sin(phi)};
+    }
+    return {std::cos(theta) * std::cos(phi), std::sin(theta), std::cos(theta) * std::sin(phi)};
+}
+
+// World point -> NDC for the same camera as ndcToWorldDir(); false if behind the camera.
+bool worldToNdc(Vec3 w, float aspect, float fovYDeg, float yawDeg, float pitchDeg, float& ndcX, float& ndcY) {
+    Vec3 c = rotateX(rotateY(w, -yawDeg), -pitchDeg);
+    if (c.z > -1e-4f) return false;
+    float tanHalfFovY = std::tan(fovYDeg * 0.5f * PI / 180.0f);
+    ndcX = (c.x / -c.z) / (tanHalfFovY * aspect);
+    ndcY = (c.y / -c.z) / tanHalfFovY;
+    return true;
+}
+
+// Screen point -> capture UV -> surface point -> the same screen point, for every mode and a few poses.
+void testProjectionRoundTrip() {
+    const ProjectionMode modes[] = {ProjectionMode::Sphere, ProjectionMode::SphereClamp,
+                                    ProjectionMode::Cylinder, ProjectionMode::Morph};
+    const float poses[][3] = {{0.0f, 0.0f, 90.0f}, {37.0f, 20.0f, 75.0f}, {-120.0f, -45.0f, 110.0f}, {200.0f, 10.0f, 60.0f}};
+    const float aspect = 16.0f / 9.0f;
+    const float thetaMaxRad = 80.0f * PI / 180.0f;
+    const float sphericity = 0.35f;
+
+    for (ProjectionMode mode : modes) {
+        int mapped = 0;
+        for (const auto& pose : poses) {
+            for (int gy = 0; gy < 9; ++gy) {
+                for (int gx = 0; gx < 9; ++gx) {
+                    float ndcX = -0.9f + 0.225f * gx;
+                    float ndcY = -0.9f + 0.225f * gy;
+                    Vec3 dir = ndcToWorldDir(ndcX, ndcY, aspect, pose[2], pose[0], pose[1]);
+                    float u = -1.0f, v = -1.0f;
+                    if (!dirToCaptureUV(mode, sphericity, thetaMaxRad, dir, u, v)) continue;
+                    ++mapped;
+                    CHECK(u >= 0.0f && u <= 1.0f);
+                    CHECK(v >= 0.0f && v <= 1.0f);
+
+                    Vec3 p = surfacePointAtUV(mode, sphericity, thetaMaxRad, u, v);
+                    float backX = 0.0f, backY = 0.0f;
+                    CHECK(worldToNdc(p, aspect, pose[2], pose[0], pose[1], backX, backY));
+                    CHECK_NEAR(backX, ndcX, 2e-3);
+                    CHECK_NEAR(backY, ndcY, 2e-3);
+                }
+            }
+        }
+        // Poses stay within +-45 deg pitch, so most of the screen hits the surface in every mode.
+        CHECK(mapped > 4 * 81 / 2);
+    }
+
+    // Looking straight ahead (-Z) hits the middle row at u = 3/4 in every mode.
+    for (ProjectionMode mode : modes) {
+        float u = 0.0f, v = 0.0f;
+        CHECK(dirToCaptureUV(mode, sphericity, thetaMaxRad, ndcToWorldDir(0.0f, 0.0f, aspect, 90.0f, 0.0f, 0.0f), u, v));
+        CHECK_NEAR(u, 0.75f, 1e-5);
+        CHECK_NEAR(v, 0.5f, 1e-4);
+    }
+
+    // Outside the clamp band / above the cylinder there is nothing to hit.
+    float u = 0.0f, v = 0.0f;
+    CHECK(!dirToCaptureUV(ProjectionMode::SphereClamp, sphericity, thetaMaxRad, {0.0f, 1.0f, 0.01f}, u, v));
+    CHECK(!dirToCaptureUV(ProjectionMode::Cylinder, sphericity, thetaMaxRad, {0.0f, 1.0f, 0.0f}, u, v));
+}
+
+} // namespace
+
+int main() {
+    testProjectionRoundTrip();
+    return testResult("test_core");
+}
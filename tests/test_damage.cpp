@@ -0,0 +1,315 @@
+// test_damage.cpp
+// Проверки геометрии повреждений (damage.h): слияние прямоугольников в DamageFrame, перевод в ячейки меша
+// (с запасом на линейную фильтрацию) и в прямоугольники экрана. Главное свойство: каждый видимый повреждённый пиксель попадает в view rects.
+
+#include "damage.h"
+#include "test_check.h"
+
+#include <random>
+
+namespace {
+
+const float PI = 3.14159265358979323846f;
+const int RINGS = 64;     // same mesh as spherical_monitor (MESH_RINGS x MESH_SECTORS)
+const int SECTORS = 128;
+
+const ProjectionMode MODES[] = {ProjectionMode::Sphere, ProjectionMode::SphereClamp,
+                                ProjectionMode::Cylinder, ProjectionMode::Morph};
+
+bool hasRect(const DamageFrame& d, DamageRect r) {
+    for (const DamageRect& q : d.rects) {
+        if (q.x == r.x && q.y == r.y && q.w == r.w && q.h == r.h) return true;
+    }
+    return false;
+}
+
+void testDamageFrameAdd() {
+    DamageFrame d;
+    d.reset(1000, 1000);
+    CHECK(d.empty());
+
+    // Clipped to the frame; fully outside is dropped.
+    d.add({-10, -20, 30, 40});
+    CHECK(d.rects.size() == 1 && hasRect(d, {0, 0, 20, 20}));
+    d.add({1000, 0, 50, 50});
+    d.add({10, 10, 0, 5});
+    CHECK(d.rects.size() == 1);
+
+    // Edge-adjacent rects merge, disjoint ones stay apart.
+    d.add({20, 0, 10, 20});
+    CHECK(d.rects.size() == 1 && hasRect(d, {0, 0, 30, 20}));
+    d.add({500, 500, 10, 10});
+    CHECK(d.rects.size() == 2);
+    CHECK(d.area() == 30 * 20 + 10 * 10);
+
+    // A rect bridging two others merges all three, even though they did not touch before.
+    d.add({30, 20, 470, 480});
+    CHECK(d.rects.size() == 1 && hasRect(d, {0, 0, 510, 510}));
+
+    // Over 60 % of the frame -> full; full absorbs everything after it.
+    d.add({0, 500, 1000, 200});
+    CHECK(d.full && d.rects.empty());
+    CHECK(d.area() == 1000LL * 1000LL);
+    d.add({0, 0, 1, 1});
+    CHECK(d.full && d.rects.empty());
+
+    // More than MAX_RECTS disjoint rects collapse into their bbox.
+    d.reset(4000, 4000);
+    for (std::size_t i = 0; i <= DamageFrame::MAX_RECTS; ++i) {
+        d.add({static_cast<int>(i) * 20, static_cast<int>(i) * 10, 5, 5});
+    }
+    const int last = static_cast<int>(DamageFrame::MAX_RECTS);
+    CHECK(!d.full);
+    CHECK(d.rects.size() == 1 && hasRect(d, {0, 0, last * 20 + 5, last * 10 + 5}));
+}
+
+// Fractional mesh coordinates of a capture UV, as drawTextured*() lays the texture out.
+void uvToMesh(ProjectionMode mode, double u, double v, double& r, double& s) {
+    s = u * SECTORS;
+    r = (mode == ProjectionMode::Cylinder) ? v * RINGS : (1.0 - v) * RINGS;
+}
+
+bool patchesContain(const std::vector<SurfacePatch>& patches, double r, double s) {
+    for (const SurfacePatch& p : patches) {
+        if (r >= p.ring0 && r <= p.ring1 && s >= p.sector0 && s <= p.sector1) return true;
+    }
+    return false;
+}
+
+void testSurfacePatches() {
+    DamageFrame d;
+    d.reset(3840, 2160);
+    std::vector<SurfacePatch> patches;
+
+    for (ProjectionMode mode : MODES) {
+        damageToSurfacePatches(mode, d, RINGS, SECTORS, patches);
+        CHECK(patches.empty());
+    }
+
+    d.add({100, 50, 300, 200});
+    d.add({3000, 1800, 840, 360}); // touches the bottom-right corner
+    for (ProjectionMode mode : MODES) {
+        damageToSurfacePatches(mode, d, RINGS, SECTORS, patches);
+        CHECK(patches.size() >= 2);
+        for (const DamageRect& rc : d.rects) {
+            for (int i = 0; i <= 4; ++i) {
+                for (int j = 0; j <= 4; ++j) {
+                    double u = (rc.x + rc.w * i / 4.0) / d.width;
+                    double v = (rc.y + rc.h * j / 4.0) / d.height;
+                    double r = 0.0, s = 0.0;
+                    uvToMesh(mode, u, v, r, s);
+                    CHECK(patchesContain(patches, r, s));
+                }
+            }
+        }
+        for (const SurfacePatch& p : patches) {
+            CHECK(p.ring0 >= 0 && p.ring1 <= RINGS && p.sector0 >= 0 && p.sector1 <= SECTORS);
+        }
+    }
+
+    d.markFull();
+    damageToSurfacePatches(ProjectionMode::Sphere, d, RINGS, SECTORS, patches);
+    CHECK(patches.size() == 1);
+    CHECK(patches[0].ring0 == 0 && patches[0].ring1 == RINGS && patches[0].sector0 == 0 && patches[0].sector1 == SECTORS);
+}
+
+bool patchesTouch(const SurfacePatch& a, const SurfacePatch& b) {
+    return a.ring0 <= b.ring1 && b.ring0 <= a.ring1 && a.sector0 <= b.sector1 && b.sector0 <= a.sector1;
+}
+
+void testMergeSurfacePatches() {
+    // Overlapping and edge-adjacent merge (also through a bridge), disjoint ones stay apart.
+    std::vector<SurfacePatch> patches = {{0, 2, 0, 2}, {2, 4, 1, 3}, {10, 12, 10, 12}, {20, 21, 20, 21},
+                                         {12, 20, 12, 20}};
+    mergeSurfacePatches(patches);
+    CHECK(patches.size() == 2);
+    long long cells = 0;
+    for (const SurfacePatch& p : patches) cells += patchCells(p);
+    CHECK(cells == 4 * 3 + 11 * 11);
+    for (std::size_t i = 0; i < patches.size(); ++i) {
+        for (std::size_t j = i + 1; j < patches.size(); ++j) CHECK(!patchesTouch(patches[i], patches[j]));
+    }
+
+    patches.clear();
+    mergeSurfacePatches(patches);
+    CHECK(patches.empty());
+}
+
+// GL_LINEAR with the default GL_REPEAT: a changed texel alters every sample within one texel of it, across
+// the texture edges too. Every texel of the (wrapped) 3x3 neighbourhood must land in the patches, and the
+// patches stay few and small: only the cells near the damage are resubmitted.
+void testSurfacePatchFilterBorder() {
+    const int W = 1920, H = 1080;
+    const DamageRect pixels[] = {{0, 0, 1, 1}, {W - 1, H - 1, 1, 1}, {W / 2, H / 2, 1, 1}, {15, 540, 1, 1},
+                                 {0, 300, 1, 1}, {700, H - 1, 1, 1}, {W - 15, 33, 15, 17}};
+    std::vector<SurfacePatch> patches;
+    for (ProjectionMode mode : MODES) {
+        for (const DamageRect& px : pixels) {
+            DamageFrame d;
+            d.reset(W, H);
+            d.add(px);
+            damageToSurfacePatches(mode, d, RINGS, SECTORS, patches);
+            CHECK(!patches.empty() && patches.size() <= 4);
+            long long cells = 0;
+            for (const SurfacePatch& p : patches) cells += patchCells(p);
+            CHECK(cells <= 16);
+            for (std::size_t i = 0; i < patches.size(); ++i) {
+                for (std::size_t j = i + 1; j < patches.size(); ++j) CHECK(!patchesTouch(patches[i], patches[j]));
+            }
+
+            for (int x = px.x - 1; x <= px.x + px.w; ++x) {
+                for (int y = px.y - 1; y <= px.y + px.h; ++y) {
+                    int tx = (x + W) % W;
+                    int ty = (y + H) % H;
+                    for (int k = 0; k < 3; ++k) {
+                        double u = (tx + 0.5 * k) / W;
+                        double v = (ty + 0.5 * k) / H;
+                        double r = 0.0, s = 0.0;
+                        uvToMesh(mode, u, v, r, s);
+                        if (!patchesContain(patches, r, s)) {
+                            std::fprintf(stderr, "mode %d: texel %d,%d next to %d,%d not covered\n",
+                                         static_cast<int>(mode), tx, ty, px.x, px.y);
+                            CHECK(false);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Point of the rendered mesh at fractional (r, s): bilinear blend of the cell's corner vertices. It lies in
+// the convex hull of the cell, like every rasterized point of the cell's two triangles.
+Vec3 meshPoint(const RenderPose& pose, float thetaMaxRad, double r, double s) {
+    int r0 = std::min(static_cast<int>(r), RINGS - 1);
+    int s0 = std::min(static_cast<int>(s), SECTORS - 1);
+    float fr = static_cast<float>(r - r0);
+    float fs = static_cast<float>(s - s0);
+    Vec3 a = surfaceVertex(pose.mode, pose.sphericity, thetaMaxRad, r0, s0, RINGS, SECTORS);
+    Vec3 b = surfaceVertex(pose.mode, pose.sphericity, thetaMaxRad, r0, s0 + 1, RINGS, SECTORS);
+    Vec3 c = surfaceVertex(pose.mode, pose.sphericity, thetaMaxRad, r0 + 1, s0, RINGS, SECTORS);
+    Vec3 e = surfaceVertex(pose.mode, pose.sphericity, thetaMaxRad, r0 + 1, s0 + 1, RINGS, SECTORS);
+    float wa = (1.0f - fr) * (1.0f - fs), wb = (1.0f - fr) * fs, wc = fr * (1.0f - fs), we = fr * fs;
+    return {wa * a.x + wb * b.x + wc * c.x + we * e.x, wa * a.y + wb * b.y + wc * c.y + we * e.y,
+            wa * a.z + wb * b.z + wc * c.z + we * e.z};
+}
+
+// Mesh point -> framebuffer pixel (GL origin) with the frustum of surfacePatchesToViewRects().
+bool meshPointToPixel(Vec3 w, const RenderPose& pose, int fbW, int fbH, float& px, float& py) {
+    Vec3 c = rotateX(rotateY(w, -pose.yawDeg), -pose.pitchDeg);
+    if (c.z > -0.1f) return false; // clipped by the near plane
+    float tanHalfFovY = std::tan(pose.fovYDeg * 0.5f * PI / 180.0f);
+    float aspect = static_cast<float>(fbW) / static_cast<float>(fbH);
+    px = ((c.x / -c.z) / (tanHalfFovY * aspect) * 0.5f + 0.5f) * fbW;
+    py = ((c.y / -c.z) / tanHalfFovY * 0.5f + 0.5f) * fbH;
+    return true;
+}
+
+bool viewRectsContain(const std::vector<ViewRect>& rects, float px, float py) {
+    for (const ViewRect& v : rects) {
+        if (px >= v.x0 && px <= v.x1 && py >= v.y0 && py <= v.y1) return true;
+    }
+    return false;
+}
+
+// Random damage and camera poses in every mode: every damaged source pixel that lands on screen must be
+// inside the view rects the renderer scissors to, otherwise partial redraw leaves stale pixels.
+void testViewRectsCoverDamage() {
+    const int fbW = 1280, fbH = 720;
+    const float thetaMaxRad = 80.0f * PI / 180.0f;
+    std::mt19937 rng(12345);
+    auto uniform = [&rng](float lo, float hi) {
+        return lo + (hi - lo) * static_cast<float>(rng() % 100001u) / 100000.0f;
+    };
+
+    std::vector<SurfacePatch> patches;
+    std::vector<ViewRect> viewRects;
+    for (ProjectionMode mode : MODES) {
+        int visible = 0;
+        int partial = 0;
+        for (int iter = 0; iter < 200; ++iter) {
+            RenderPose pose;
+            pose.mode = mode;
+            pose.yawDeg = uniform(-180.0f, 180.0f);
+            pose.pitchDeg = uniform(-60.0f, 60.0f);
+            pose.fovYDeg = uniform(50.0f, 110.0f);
+            pose.sphericity = uniform(0.0f, 1.0f);
+
+            DamageFrame d;
+            d.reset(3840, 2160);
+            int nrects = 1 + static_cast<int>(rng() % 3u);
+            for (int k = 0; k < nrects; ++k) {
+                int w = 1 + static_cast<int>(rng() % 600u);
+                int h = 1 + static_cast<int>(rng() % 400u);
+                d.add({static_cast<int>(rng() % 3840u), static_cast<int>(rng() % 2160u), w, h});
+            }
+
+            damageToSurfacePatches(mode, d, RINGS, SECTORS, patches);
+            surfacePatchesToViewRects(patches, pose, thetaMaxRad, RINGS, SECTORS, fbW, fbH, viewRects);
+            for (const ViewRect& v : viewRects) {
+                CHECK(v.x0 >= 0 && v.y0 >= 0 && v.x1 <= fbW && v.y1 <= fbH && v.x0 < v.x1 && v.y0 < v.y1);
+            }
+            if (viewRects.size() != 1 || viewRectArea(viewRects[0]) < static_cast<long long>(fbW) * fbH) ++partial;
+
+            for (const DamageRect& rc : d.rects) {
+                // Pixel edges and centres of the rect, on an 8x8 grid plus the exact corners.
+                for (int i = 0; i <= 8; ++i) {
+                    for (int j = 0; j <= 8; ++j) {
+                        double u = (rc.x + rc.w * i / 8.0) / d.width;
+                        double v = (rc.y + rc.h * j / 8.0) / d.height;
+                        double r = 0.0, s = 0.0;
+                        uvToMesh(mode, u, v, r, s);
+                        float px = 0.0f, py = 0.0f;
+                        if (!meshPointToPixel(meshPoint(pose, thetaMaxRad, r, s), pose, fbW, fbH, px, py)) continue;
+                        if (px < 0.0f || px > fbW || py < 0.0f || py > fbH) continue;
+                        ++visible;
+                        if (!viewRectsContain(viewRects, px, py)) {
+                            std::fprintf(stderr, "mode %d iter %d: pixel (%.1f, %.1f) of rect %d,%d %dx%d not covered\n",
+                                         static_cast<int>(mode), iter, px, py, rc.x, rc.y, rc.w, rc.h);
+                            CHECK(false);
+                        }
+                    }
+                }
+            }
+        }
+        // The random scenes must actually exercise the partial path, not just whole-viewport redraws.
+        CHECK(visible > 1000);
+        CHECK(partial > 50);
+    }
+}
+
+void testViewRectLimits() {
+    const int fbW = 1280, fbH = 720;
+    RenderPose pose; // looking down -Z, u = 3/4 in the middle of the screen
+    std::vector<ViewRect> viewRects;
+
+    // Nothing damaged -> nothing to repaint.
+    surfacePatchesToViewRects({}, pose, 1.0f, RINGS, SECTORS, fbW, fbH, viewRects);
+    CHECK(viewRects.empty());
+
+    // Patch straddling the camera plane (the whole surface) -> the whole viewport.
+    surfacePatchesToViewRects({{0, RINGS, 0, SECTORS}}, pose, 1.0f, RINGS, SECTORS, fbW, fbH, viewRects);
+    CHECK(viewRects.size() == 1);
+    CHECK(viewRects[0].x0 == 0 && viewRects[0].y0 == 0 && viewRects[0].x1 == fbW && viewRects[0].y1 == fbH);
+
+    // Many small visible patches collapse into at most 4 rects.
+    std::vector<SurfacePatch> patches;
+    for (int k = 0; k < 8; ++k) {
+        int s = SECTORS * 3 / 4 - 8 + 2 * k;
+        patches.push_back({RINGS / 2 - 4 + k, RINGS / 2 - 3 + k, s, s + 1});
+    }
+    surfacePatchesToViewRects(patches, pose, 1.0f, RINGS, SECTORS, fbW, fbH, viewRects);
+    CHECK(!viewRects.empty() && viewRects.size() <= 4);
+}
+
+} // namespace
+
+int main() {
+    testDamageFrameAdd();
+    testSurfacePatches();
+    testMergeSurfacePatches();
+    testSurfacePatchFilterBorder();
+    testViewRectsCoverDamage();
+    testViewRectLimits();
+    return testResult("test_damage");
+}
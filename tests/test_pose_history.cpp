@@ -0,0 +1,74 @@
+// test_pose_history.cpp
+// Проверки компенсации задержки мыши: выбор позы по моменту показа, измерение локальной задержки вывода.
+
+#include "pose_history.h"
+#include "test_check.h"
+
+namespace {
+
+RenderPose poseWithFrame(std::uint64_t frameId, std::int64_t presentNs) {
+    RenderPose p;
+    p.frameId = frameId;
+    p.presentNs = presentNs;
+    p.yawDeg = static_cast<float>(frameId);
+    return p;
+}
+
+void testPoseHistory() {
+    PoseHistory history;
+    RenderPose out;
+    CHECK(history.empty());
+    CHECK(!history.poseAt(0, out));
+
+    for (std::uint64_t f = 1; f <= 3; ++f) history.push(poseWithFrame(f, static_cast<std::int64_t>(f) * 100));
+    CHECK(!history.empty());
+    CHECK(history.latest().frameId == 3);
+
+    // Exact present time -> that frame; between two presents -> the older one (still on screen).
+    CHECK(history.poseAt(200, out) && out.frameId == 2);
+    CHECK(history.poseAt(299, out) && out.frameId == 2);
+    // After the newest / before the oldest -> clamp to the ends.
+    CHECK(history.poseAt(1000000, out) && out.frameId == 3);
+    CHECK(history.poseAt(-5, out) && out.frameId == 1);
+
+    // Wrap-around: only the last CAPACITY frames are kept.
+    PoseHistory full;
+    const std::uint64_t total = PoseHistory::CAPACITY + 10;
+    for (std::uint64_t f = 0; f < total; ++f) full.push(poseWithFrame(f, static_cast<std::int64_t>(f) * 10));
+    CHECK(full.latest().frameId == total - 1);
+    CHECK(full.poseAt(0, out) && out.frameId == 10);
+    CHECK(full.poseAt(static_cast<std::int64_t>(total - 5) * 10 + 3, out) && out.frameId == total - 5);
+}
+
+void testOutputLatency() {
+    const std::int64_t ms = 1000000;
+    OutputLatency latency;
+    // Nothing measured yet: the whole calibrated round trip is looked back.
+    CHECK(latency.localNs() == 0);
+    CHECK(latency.lookbackNs(100 * ms) == 100 * ms);
+
+    // First frame sets the estimate, later ones move it by 1/8 of the difference.
+    latency.addFrame(1000 * ms, 1016 * ms);
+    CHECK(latency.localNs() == 16 * ms);
+    CHECK(latency.lookbackNs(100 * ms) == 84 * ms);
+    latency.addFrame(2000 * ms, 2024 * ms);
+    CHECK(latency.localNs() == 17 * ms);
+
+    // A long run of slow frames converges; the lookback never goes negative.
+    for (int i = 0; i < 200; ++i) latency.addFrame(0, 150 * ms);
+    CHECK_NEAR(static_cast<double>(latency.localNs()) / ms, 150.0, 1.0);
+    CHECK(latency.lookbackNs(100 * ms) == 0);
+
+    // Clock skew between poll and present (present before poll) counts as zero, not negative.
+    OutputLatency skewed;
+    skewed.addFrame(10 * ms, 5 * ms);
+    CHECK(skewed.localNs() == 0);
+}
+
+} // namespace
+
+int main() {
+    testPoseHistory();
+    testOutputLatency();
+    return testResult("test_pose_history");
+}
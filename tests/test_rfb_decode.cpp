@@ -0,0 +1,436 @@
+// test_rfb_decode.cpp
+// Проверки декодеров rfb_loadgen на собранных вручную прямоугольниках: Tight (compact length, fill,
+// copy/palette/gradient, JPEG, сброс zlib-потоков) и ZRLE (raw, solid, packed palette, RLE). После
+// каждого потока проверяются и пиксели, и то, что декодер съел ровно все байты (не потерял синхронизацию).
+
+#include "tools/rfb_decode.h"
+#include "test_check.h"
+
+#include <random>
+
+namespace {
+
+const int FB_W = 200;
+const int FB_H = 150;
+
+using Bytes = std::vector<std::uint8_t>;
+
+class MemorySource : public RfbSource {
+public:
+    explicit MemorySource(const Bytes& data) : data_(data) {}
+
+    bool read(void* dst, std::size_t n) override {
+        if (data_.size() - pos_ < n) {
+            pos_ = data_.size();
+            return false;
+        }
+        std::memcpy(dst, data_.data() + pos_, n);
+        pos_ += n;
+        return true;
+    }
+
+    bool consumed() const { return pos_ == data_.size(); }
+
+private:
+    const Bytes& data_;
+    std::size_t pos_ = 0;
+};
+
+// Server side of one zlib stream: every rect is flushed with Z_SYNC_FLUSH, the stream stays open.
+class Deflater {
+public:
+    Deflater() { reset(); }
+    ~Deflater() { deflateEnd(&zs_); }
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    void reset() {
+        if (open_) deflateEnd(&zs_);
+        zs_ = z_stream{};
+        deflateInit(&zs_, Z_DEFAULT_COMPRESSION);
+        open_ = true;
+    }
+
+    Bytes deflateRect(const Bytes& in) {
+        Bytes out(in.size() + in.size() / 8 + 64);
+        zs_.next_in = const_cast<Bytef*>(in.data());
+        zs_.avail_in = static_cast<uInt>(in.size());
+        zs_.next_out = out.data();
+        zs_.avail_out = static_cast<uInt>(out.size());
+        deflate(&zs_, Z_SYNC_FLUSH);
+        out.resize(out.size() - zs_.avail_out);
+        return out;
+    }
+
+private:
+    z_stream zs_{};
+    bool open_ = false;
+};
+
+// Builds one update's rect stream and the framebuffer a correct decoder must end up with.
+struct Scene {
+    Bytes stream;
+    std::vector<std::uint32_t> expect = std::vector<std::uint32_t>(static_cast<std::size_t>(FB_W) * FB_H, 0);
+    std::mt19937 rng{4242};
+
+    std::uint32_t color() { return rng() & 0xffffff; }
+    void set(int x, int y, std::uint32_t c) { expect[static_cast<std::size_t>(y) * FB_W + static_cast<std::size_t>(x)] = c; }
+    std::uint32_t at(int x, int y) const { return expect[static_cast<std::size_t>(y) * FB_W + static_cast<std::size_t>(x)]; }
+
+    void u8(int v) { stream.push_back(static_cast<std::uint8_t>(v)); }
+    void bytes(const Bytes& b) { stream.insert(stream.end(), b.begin(), b.end()); }
+    void u32(std::uint32_t v) {
+        std::uint8_t b[4];
+        wr32(b, v);
+        stream.insert(stream.end(), b, b + 4);
+    }
+    void tpixel(std::uint32_t c) { u8(static_cast<int>(c >> 16) & 255); u8(static_cast<int>(c >> 8) & 255); u8(static_cast<int>(c) & 255); }
+    static void cpixel(Bytes& out, std::uint32_t c) {
+        out.push_back(static_cast<std::uint8_t>(c));
+        out.push_back(static_cast<std::uint8_t>(c >> 8));
+        out.push_back(static_cast<std::uint8_t>(c >> 16));
+    }
+    void compactLen(std::size_t n) {
+        u8(static_cast<int>(n & 0x7f) | (n > 0x7f ? 0x80 : 0));
+        if (n > 0x7f) u8(static_cast<int>((n >> 7) & 0x7f) | (n > 0x3fff ? 0x80 : 0));
+        if (n > 0x3fff) u8(static_cast<int>(n >> 14));
+    }
+};
+
+struct Rect {
+    std::int32_t enc;
+    int x, y, w, h;
+};
+
+// Decodes `rects` (bodies laid out back to back in scene.stream) and compares with scene.expect.
+bool decodeAll(RfbDecoder& dec, const Scene& scene, const std::vector<Rect>& rects) {
+    MemorySource in(scene.stream);
+    for (const Rect& r : rects) {
+        if (!dec.decodeRect(in, r.enc, r.x, r.y, r.w, r.h)) {
+            std::fprintf(stderr, "decodeRect(enc %d at %d,%d) failed: %s\n", r.enc, r.x, r.y, dec.error().c_str());
+            return false;
+        }
+    }
+    CHECK(in.consumed());
+    int wrong = 0;
+    for (int y = 0; y < FB_H; ++y) {
+        for (int x = 0; x < FB_W; ++x) {
+            if (dec.pixel(x, y) != scene.at(x, y) && wrong++ < 5) {
+                std::fprintf(stderr, "pixel %d,%d: got %06x want %06x\n", x, y, dec.pixel(x, y), scene.at(x, y));
+            }
+        }
+    }
+    CHECK(wrong == 0);
+    return wrong == 0;
+}
+
+void testTight() {
+    Scene sc;
+    Deflater streams[4];
+    std::vector<Rect> rects;
+
+    // Fill: the whole framebuffer.
+    std::uint32_t bg = 0x123456;
+    for (int y = 0; y < FB_H; ++y) for (int x = 0; x < FB_W; ++x) sc.set(x, y, bg);
+    rects.push_back({ENC_TIGHT, 0, 0, FB_W, FB_H});
+    sc.u8(0x80);
+    sc.tpixel(bg);
+
+    // Basic, copy filter, stream 0; random pixels do not compress, so the length takes 3 bytes.
+    {
+        int x0 = 10, y0 = 5, w = 90, h = 70;
+        Bytes data;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                std::uint32_t c = sc.color();
+                sc.set(x0 + x, y0 + y, c);
+                data.push_back(static_cast<std::uint8_t>(c >> 16));
+                data.push_back(static_cast<std::uint8_t>(c >> 8));
+                data.push_back(static_cast<std::uint8_t>(c));
+            }
+        }
+        Bytes z = streams[0].deflateRect(data);
+        CHECK(z.size() > 0x3fff);
+        rects.push_back({ENC_TIGHT, x0, y0, w, h});
+        sc.u8(0x00);
+        sc.compactLen(z.size());
+        sc.bytes(z);
+    }
+
+    // Two-colour palette on stream 1 (explicit filter), 1 bit per pixel, rows padded to bytes.
+    {
+        int x0 = 110, y0 = 2, w = 21, h = 9;
+        std::uint32_t pal[2] = {sc.color(), sc.color()};
+        Bytes data;
+        for (int y = 0; y < h; ++y) {
+            Bytes row(static_cast<std::size_t>(w + 7) / 8, 0);
+            for (int x = 0; x < w; ++x) {
+                int i = static_cast<int>(sc.rng() & 1);
+                sc.set(x0 + x, y0 + y, pal[i]);
+                if (i) row[static_cast<std::size_t>(x / 8)] |= static_cast<std::uint8_t>(0x80 >> (x % 8));
+            }
+            data.insert(data.end(), row.begin(), row.end());
+        }
+        Bytes z = streams[1].deflateRect(data);
+        rects.push_back({ENC_TIGHT, x0, y0, w, h});
+        sc.u8(0x50);
+        sc.u8(1);
+        sc.u8(1);
+        sc.tpixel(pal[0]);
+        sc.tpixel(pal[1]);
+        sc.compactLen(z.size());
+        sc.bytes(z);
+    }
+
+    // Five-colour palette, 3x3 = 9 index bytes: under 12 bytes, so sent without zlib.
+    {
+        int x0 = 150, y0 = 100, w = 3, h = 3;
+        std::uint32_t pal[5];
+        for (auto& c : pal) c = sc.color();
+        rects.push_back({ENC_TIGHT, x0, y0, w, h});
+        sc.u8(0x50);
+        sc.u8(1);
+        sc.u8(4);
+        for (std::uint32_t c : pal) sc.tpixel(c);
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                int i = static_cast<int>(sc.rng() % 5);
+                sc.set(x0 + x, y0 + y, pal[i]);
+                sc.u8(i);
+            }
+        }
+    }
+
+    // Gradient filter on stream 2; the same rect also asks to reset stream 0.
+    {
+        int x0 = 120, y0 = 20, w = 12, h = 8;
+        std::vector<std::uint8_t> dec(static_cast<std::size_t>(w) * h * 3, 0);
+        auto ch = [&](int x, int y, int k) -> int {
+            return (x < 0 || y < 0) ? 0 : dec[(static_cast<std::size_t>(y) * w + static_cast<std::size_t>(x)) * 3 + static_cast<std::size_t>(k)];
+        };
+        Bytes data;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                std::uint32_t c = sc.color();
+                sc.set(x0 + x, y0 + y, c);
+                int v[3] = {static_cast<int>(c >> 16) & 255, static_cast<int>(c >> 8) & 255, static_cast<int>(c) & 255};
+                for (int k = 0; k < 3; ++k) {
+                    int pred = std::clamp(ch(x - 1, y, k) + ch(x, y - 1, k) - ch(x - 1, y - 1, k), 0, 255);
+                    data.push_back(static_cast<std::uint8_t>(v[k] - pred));
+                    dec[(static_cast<std::size_t>(y) * w + static_cast<std::size_t>(x)) * 3 + static_cast<std::size_t>(k)] =
+                        static_cast<std::uint8_t>(v[k]);
+                }
+            }
+        }
+        streams[0].reset();
+        Bytes z = streams[2].deflateRect(data);
+        rects.push_back({ENC_TIGHT, x0, y0, w, h});
+        sc.u8(0x60 | 0x01);
+        sc.u8(2);
+        sc.compactLen(z.size());
+        sc.bytes(z);
+    }
+
+    // Copy filter on the freshly reset stream 0 (fails if the decoder did not reset it too).
+    {
+        int x0 = 40, y0 = 100, w = 10, h = 10;
+        Bytes data;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                std::uint32_t c = sc.color() & 0xf0f0f0; // compressible: 2-byte compact length
+                sc.set(x0 + x, y0 + y, c);
+                data.push_back(static_cast<std::uint8_t>(c >> 16));
+                data.push_back(static_cast<std::uint8_t>(c >> 8));
+                data.push_back(static_cast<std::uint8_t>(c));
+            }
+        }
+        Bytes z = streams[0].deflateRect(data);
+        rects.push_back({ENC_TIGHT, x0, y0, w, h});
+        sc.u8(0x00);
+        sc.compactLen(z.size());
+        sc.bytes(z);
+    }
+
+    // JPEG: skipped, but the rect after it must still parse. Then a fill that is partly off-screen.
+    rects.push_back({ENC_TIGHT, 0, 140, 10, 10});
+    sc.u8(0x90);
+    sc.compactLen(300);
+    sc.bytes(Bytes(300, 0xab));
+    {
+        std::uint32_t c = sc.color();
+        for (int y = 140; y < FB_H; ++y) for (int x = 190; x < FB_W; ++x) sc.set(x, y, c);
+        rects.push_back({ENC_TIGHT, 190, 140, 20, 20});
+        sc.u8(0x80);
+        sc.tpixel(c);
+    }
+
+    RfbDecoder dec;
+    dec.resize(FB_W, FB_H);
+    CHECK(decodeAll(dec, sc, rects));
+
+    // Compression type 0xA does not exist: rejected with a reason.
+    Bytes bad = {0xa0};
+    MemorySource in(bad);
+    CHECK(!dec.decodeRect(in, ENC_TIGHT, 0, 0, 4, 4));
+    CHECK(!dec.error().empty());
+}
+
+void testZrle() {
+    Scene sc;
+    Deflater zs;
+    Bytes tiles;
+
+    // 150x90 at (20, 30): 3x2 tiles of up to 64x64, one subencoding per tile, in tile order.
+    const int x0 = 20, y0 = 30, w = 150, h = 90;
+    int kind = 0;
+    for (int ty = y0; ty < y0 + h; ty += 64) {
+        int th = std::min(64, y0 + h - ty);
+        for (int tx = x0; tx < x0 + w; tx += 64) {
+            int tw = std::min(64, x0 + w - tx);
+            int total = tw * th;
+            switch (kind++) {
+                case 0: { // raw CPIXELs
+                    tiles.push_back(0);
+                    for (int i = 0; i < total; ++i) {
+                        std::uint32_t c = sc.color();
+                        sc.set(tx + i % tw, ty + i / tw, c);
+                        Scene::cpixel(tiles, c);
+                    }
+                    break;
+                }
+                case 1: { // solid
+                    std::uint32_t c = sc.color();
+                    tiles.push_back(1);
+                    Scene::cpixel(tiles, c);
+                    for (int i = 0; i < total; ++i) sc.set(tx + i % tw, ty + i / tw, c);
+                    break;
+                }
+                case 2: { // packed palette, 3 colours -> 2 bits per pixel, rows padded to bytes
+                    std::uint32_t pal[3] = {sc.color(), sc.color(), sc.color()};
+                    tiles.push_back(3);
+                    for (std::uint32_t c : pal) Scene::cpixel(tiles, c);
+                    for (int y = 0; y < th; ++y) {
+                        Bytes row(static_cast<std::size_t>(tw * 2 + 7) / 8, 0);
+                        for (int x = 0; x < tw; ++x) {
+                            int i = static_cast<int>(sc.rng() % 3);
+                            sc.set(tx + x, ty + y, pal[i]);
+                            row[static_cast<std::size_t>(x * 2 / 8)] |= static_cast<std::uint8_t>(i << (6 - (x * 2) % 8));
+                        }
+                        tiles.insert(tiles.end(), row.begin(), row.end());
+                    }
+                    break;
+                }
+                case 3: { // plain RLE, runs longer than 255 use 255-continuation bytes
+                    tiles.push_back(128);
+                    const int runs[] = {1, 5, 300, 600};
+                    for (int i = 0; i < total;) {
+                        int run = std::min(total - i, runs[sc.rng() % 4]);
+                        std::uint32_t c = sc.color();
+                        for (int k = 0; k < run; ++k) sc.set(tx + (i + k) % tw, ty + (i + k) / tw, c);
+                        i += run;
+                        Scene::cpixel(tiles, c);
+                        int rest = run - 1;
+                        for (; rest >= 255; rest -= 255) tiles.push_back(255);
+                        tiles.push_back(static_cast<std::uint8_t>(rest));
+                    }
+                    break;
+                }
+                default: { // palette RLE: index with the top bit set carries a run length
+                    std::uint32_t pal[4] = {sc.color(), sc.color(), sc.color(), sc.color()};
+                    tiles.push_back(128 + 4);
+                    for (std::uint32_t c : pal) Scene::cpixel(tiles, c);
+                    const int runs[] = {1, 3, 270};
+                    for (int i = 0; i < total;) {
+                        int run = std::min(total - i, runs[sc.rng() % 3]);
+                        int j = static_cast<int>(sc.rng() % 4);
+                        for (int k = 0; k < run; ++k) sc.set(tx + (i + k) % tw, ty + (i + k) / tw, pal[j]);
+                        i += run;
+                        if (run == 1) {
+                            tiles.push_back(static_cast<std::uint8_t>(j));
+                        } else {
+                            tiles.push_back(static_cast<std::uint8_t>(j | 0x80));
+                            int rest = run - 1;
+                            for (; rest >= 255; rest -= 255) tiles.push_back(255);
+                            tiles.push_back(static_cast<std::uint8_t>(rest));
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    CHECK(kind == 6);
+    Bytes z = zs.deflateRect(tiles);
+    sc.u32(static_cast<std::uint32_t>(z.size()));
+    sc.bytes(z);
+
+    // Second rect on the same (not reset) zlib stream: one solid tile.
+    std::uint32_t c = sc.color();
+    Bytes solid = {1};
+    Scene::cpixel(solid, c);
+    for (int y = 0; y < 10; ++y) for (int x = 0; x < 10; ++x) sc.set(x, y, c);
+    Bytes z2 = zs.deflateRect(solid);
+    sc.u32(static_cast<std::uint32_t>(z2.size()));
+    sc.bytes(z2);
+
+    RfbDecoder dec;
+    dec.resize(FB_W, FB_H);
+    CHECK(decodeAll(dec, sc, {{ENC_ZRLE, x0, y0, w, h}, {ENC_ZRLE, 0, 0, 10, 10}}));
+
+    // A tile stream that ends early is an error, not a silently half-drawn rect.
+    Deflater fresh;
+    Bytes shortTile = {0, 1, 2, 3};
+    Bytes zs3 = fresh.deflateRect(shortTile);
+    Bytes msg;
+    msg.resize(4);
+    wr32(msg.data(), static_cast<std::uint32_t>(zs3.size()));
+    msg.insert(msg.end(), zs3.begin(), zs3.end());
+    RfbDecoder dec2;
+    dec2.resize(FB_W, FB_H);
+    MemorySource in(msg);
+    CHECK(!dec2.decodeRect(in, ENC_ZRLE, 0, 0, 8, 8));
+    CHECK(!dec2.error().empty());
+}
+
+void testRawAndCopyRect() {
+    Scene sc;
+    std::vector<Rect> rects;
+
+    // Raw: little-endian 32bpp pixels, row after row.
+    const int x0 = 5, y0 = 7, w = 6, h = 4;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            std::uint32_t c = sc.color();
+            sc.set(x0 + x, y0 + y, c);
+            for (int k = 0; k < 4; ++k) sc.u8(static_cast<int>(c >> (8 * k)) & 255);
+        }
+    }
+    rects.push_back({ENC_RAW, x0, y0, w, h});
+
+    // CopyRect of the raw block to (100, 50).
+    for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x) sc.set(100 + x, 50 + y, sc.at(x0 + x, y0 + y));
+    sc.u8(0);
+    sc.u8(x0);
+    sc.u8(0);
+    sc.u8(y0);
+    rects.push_back({ENC_COPYRECT, 100, 50, w, h});
+
+    RfbDecoder dec;
+    dec.resize(FB_W, FB_H);
+    CHECK(decodeAll(dec, sc, rects));
+
+    // Unknown encodings cannot be skipped (their length is unknown): rejected.
+    Bytes none;
+    MemorySource in(none);
+    CHECK(!dec.decodeRect(in, 5 /* Hextile */, 0, 0, 1, 1));
+    CHECK(dec.error() == "unexpected encoding 5");
+}
+
+} // namespace
+
+int main() {
+    testRawAndCopyRect();
+    testTight();
+    testZrle();
+    return testResult("test_rfb_decode");
+}
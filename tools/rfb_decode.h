@@ -0,0 +1,422 @@
+// rfb_decode.h
+// Декодеры RFB-апдейтов rfb_loadgen: Raw, CopyRect, Tight (fill/JPEG/basic с фильтрами copy/palette/
+// gradient, четыре zlib-потока) и ZRLE в локальный framebuffer. Отдельно от транспорта, чтобы
+// tests/test_rfb_decode.cpp мог кормить им собранные вручную прямоугольники: декодер, потерявший
+// синхронизацию с потоком, молча портит все метрики клиента.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+// RFB encoding numbers.
+static constexpr std::int32_t ENC_RAW = 0;
+static constexpr std::int32_t ENC_COPYRECT = 1;
+static constexpr std::int32_t ENC_TIGHT = 7;
+static constexpr std::int32_t ENC_ZRLE = 16;
+static constexpr std::int32_t ENC_DESKTOP_SIZE = -223;
+static constexpr std::int32_t ENC_LAST_RECT = -224;
+static constexpr std::int32_t ENC_QUALITY_0 = -32;
+static constexpr std::int32_t ENC_COMPRESS_0 = -256;
+
+static inline std::uint16_t rd16(const std::uint8_t* p) { return static_cast<std::uint16_t>((p[0] << 8) | p[1]); }
+static inline std::uint32_t rd32(const std::uint8_t* p) {
+    return (static_cast<std::uint32_t>(p[0]) << 24) | (static_cast<std::uint32_t>(p[1]) << 16) |
+           (static_cast<std::uint32_t>(p[2]) << 8) | static_cast<std::uint32_t>(p[3]);
+}
+static inline void wr16(std::uint8_t* p, std::uint16_t v) { p[0] = static_cast<std::uint8_t>(v >> 8); p[1] = static_cast<std::uint8_t>(v); }
+static inline void wr32(std::uint8_t* p, std::uint32_t v) {
+    p[0] = static_cast<std::uint8_t>(v >> 24); p[1] = static_cast<std::uint8_t>(v >> 16);
+    p[2] = static_cast<std::uint8_t>(v >> 8);  p[3] = static_cast<std::uint8_t>(v);
+}
+
+// Byte stream rect bodies are read from: the RFB connection in rfb_loadgen, a buffer in tests.
+class RfbSource {
+public:
+    virtual ~RfbSource() = default;
+
+    virtual bool read(void* dst, std::size_t n) = 0;
+
+    bool skip(std::size_t n) {
+        std::uint8_t tmp[4096];
+        while (n > 0) {
+            std::size_t take = std::min(n, sizeof(tmp));
+            if (!read(tmp, take)) return false;
+            n -= take;
+        }
+        return true;
+    }
+};
+
+// One persistent zlib stream: ZRLE keeps one per connection, Tight four (reset on request).
+class Inflater {
+public:
+    Inflater() { ok_ = inflateInit(&zs_) == Z_OK; }
+    ~Inflater() {
+        if (ok_) inflateEnd(&zs_);
+    }
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    void reset() {
+        if (ok_) inflateReset(&zs_);
+    }
+
+    // Appends everything `in` inflates to; the stream stays open for the next rectangle.
+    bool inflateAll(const std::uint8_t* in, std::size_t n, std::vector<std::uint8_t>& out) {
+        if (!ok_) return false;
+        zs_.next_in = const_cast<Bytef*>(in);
+        zs_.avail_in = static_cast<uInt>(n);
+        for (;;) {
+            std::size_t base = out.size();
+            out.resize(base + 65536);
+            zs_.next_out = out.data() + base;
+            zs_.avail_out = 65536;
+            int rc = inflate(&zs_, Z_SYNC_FLUSH);
+            out.resize(base + (65536 - zs_.avail_out));
+            if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) return false;
+            if (rc == Z_STREAM_END || (zs_.avail_in == 0 && zs_.avail_out != 0)) return true;
+            if (rc == Z_BUF_ERROR && zs_.avail_out != 0) return false; // truncated input
+        }
+    }
+
+private:
+    z_stream zs_{};
+    bool     ok_ = false;
+};
+
+// Bounds-checked cursor over an inflated buffer; reads past the end return 0 and clear ok.
+struct ByteReader {
+    const std::uint8_t* p = nullptr;
+    std::size_t n = 0;
+    std::size_t pos = 0;
+    bool ok = true;
+
+    std::uint8_t u8() {
+        if (pos >= n) {
+            ok = false;
+            return 0;
+        }
+        return p[pos++];
+    }
+    const std::uint8_t* take(std::size_t k) {
+        if (n - pos < k) {
+            ok = false;
+            pos = n;
+            return nullptr;
+        }
+        const std::uint8_t* r = p + pos;
+        pos += k;
+        return r;
+    }
+};
+
+// Client framebuffer in the pixel format rfb_loadgen asks for (32bpp little-endian, depth 24,
+// red at bit 16). Keeps the per-connection zlib state, so one decoder serves one connection.
+class RfbDecoder {
+public:
+    void resize(int w, int h) {
+        width_ = w;
+        height_ = h;
+        fb_.assign(static_cast<std::size_t>(w) * static_cast<std::size_t>(h), 0);
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    std::uint32_t pixel(int x, int y) const {
+        return fb_[static_cast<std::size_t>(y) * static_cast<std::size_t>(width_) + static_cast<std::size_t>(x)];
+    }
+    // Why the last decodeRect() failed; empty if the source simply ran dry.
+    const std::string& error() const { return error_; }
+
+    // Consumes exactly one rectangle body (the part after its 12-byte header). false = malformed,
+    // unsupported or truncated: the stream can no longer be parsed.
+    bool decodeRect(RfbSource& in, std::int32_t enc, int x, int y, int w, int h) {
+        error_.clear();
+        if (enc == ENC_RAW) return decodeRaw(in, x, y, w, h);
+        if (enc == ENC_COPYRECT) {
+            std::uint8_t src[4];
+            if (!in.read(src, 4)) return false;
+            copyRect(rd16(src), rd16(src + 2), x, y, w, h);
+            return true;
+        }
+        if (enc == ENC_TIGHT) return decodeTight(in, x, y, w, h);
+        if (enc == ENC_ZRLE) return decodeZrle(in, x, y, w, h);
+        error_ = "unexpected encoding " + std::to_string(enc);
+        return false;
+    }
+
+private:
+    bool decodeRaw(RfbSource& in, int x, int y, int w, int h) {
+        std::size_t rowBytes = static_cast<std::size_t>(w) * 4;
+        bool inside = x + w <= width_ && y + h <= height_;
+        for (int row = 0; row < h; ++row) {
+            if (inside) {
+                std::uint32_t* dst = fb_.data() + static_cast<std::size_t>(y + row) * static_cast<std::size_t>(width_) + x;
+                if (!in.read(dst, rowBytes)) return false;
+            } else if (!in.skip(rowBytes)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void putPixel(int x, int y, std::uint32_t c) {
+        if (x < 0 || y < 0 || x >= width_ || y >= height_) return;
+        fb_[static_cast<std::size_t>(y) * static_cast<std::size_t>(width_) + static_cast<std::size_t>(x)] = c;
+    }
+
+    void fillRect(int x, int y, int w, int h, std::uint32_t c) {
+        for (int row = 0; row < h; ++row) {
+            for (int col = 0; col < w; ++col) putPixel(x + col, y + row, c);
+        }
+    }
+
+    // Tight TPIXEL for our 32bpp/depth 24 format: R, G, B bytes.
+    static std::uint32_t tightPixel(const std::uint8_t* p) {
+        return (static_cast<std::uint32_t>(p[0]) << 16) | (static_cast<std::uint32_t>(p[1]) << 8) | p[2];
+    }
+
+    // ZRLE CPIXEL: the three significant bytes of a little-endian pixel (B, G, R).
+    static std::uint32_t zrlePixel(const std::uint8_t* p) {
+        return (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[1]) << 8) | p[0];
+    }
+
+    // Tight "compact length": 1-3 bytes, 7 bits each, high bit = more.
+    static bool readCompactLen(RfbSource& in, std::size_t& len) {
+        std::uint8_t b = 0;
+        if (!in.read(&b, 1)) return false;
+        len = b & 0x7f;
+        if (b & 0x80) {
+            if (!in.read(&b, 1)) return false;
+            len |= static_cast<std::size_t>(b & 0x7f) << 7;
+            if (b & 0x80) {
+                if (!in.read(&b, 1)) return false;
+                len |= static_cast<std::size_t>(b) << 14;
+            }
+        }
+        return true;
+    }
+
+    bool decodeTight(RfbSource& in, int x, int y, int w, int h) {
+        std::uint8_t ctl = 0;
+        if (!in.read(&ctl, 1)) return false;
+        for (int i = 0; i < 4; ++i) {
+            if (ctl & (1 << i)) tight_[i].reset();
+        }
+        int comp = ctl >> 4;
+
+        if (comp == 0x8) { // fill
+            std::uint8_t px[3];
+            if (!in.read(px, 3)) return false;
+            fillRect(x, y, w, h, tightPixel(px));
+            return true;
+        }
+        if (comp == 0x9) { // JPEG: consumed, not decoded (only the server side is measured)
+            std::size_t len = 0;
+            return readCompactLen(in, len) && in.skip(len);
+        }
+        if (comp > 0x9) {
+            error_ = "bad tight compression " + std::to_string(comp);
+            return false;
+        }
+
+        // Basic compression: optional filter, then zlib on stream (comp & 3) unless tiny.
+        int filter = 0;
+        if (comp & 0x4) {
+            std::uint8_t f = 0;
+            if (!in.read(&f, 1)) return false;
+            filter = f;
+        }
+        std::vector<std::uint32_t> palette;
+        std::size_t rowBytes = static_cast<std::size_t>(w) * 3;
+        if (filter == 1) {
+            std::uint8_t n = 0;
+            if (!in.read(&n, 1)) return false;
+            palette.resize(static_cast<std::size_t>(n) + 1);
+            for (auto& c : palette) {
+                std::uint8_t px[3];
+                if (!in.read(px, 3)) return false;
+                c = tightPixel(px);
+            }
+            rowBytes = palette.size() == 2 ? (static_cast<std::size_t>(w) + 7) / 8 : static_cast<std::size_t>(w);
+        } else if (filter != 0 && filter != 2) {
+            error_ = "bad tight filter " + std::to_string(filter);
+            return false;
+        }
+
+        std::size_t dataSize = rowBytes * static_cast<std::size_t>(h);
+        pixels_.clear();
+        if (dataSize < 12) {
+            pixels_.resize(dataSize);
+            if (!in.read(pixels_.data(), dataSize)) return false;
+        } else {
+            std::size_t len = 0;
+            if (!readCompactLen(in, len)) return false;
+            zbuf_.resize(len);
+            if (!in.read(zbuf_.data(), len)) return false;
+            if (!tight_[comp & 3].inflateAll(zbuf_.data(), len, pixels_)) {
+                error_ = "tight zlib error";
+                return false;
+            }
+            if (pixels_.size() < dataSize) {
+                error_ = "tight data too short";
+                return false;
+            }
+        }
+
+        const std::uint8_t* d = pixels_.data();
+        if (filter == 2) {
+            gradRow_.assign(rowBytes, 0);
+            gradPrev_.assign(rowBytes, 0);
+        }
+        for (int row = 0; row < h; ++row) {
+            const std::uint8_t* r = d + static_cast<std::size_t>(row) * rowBytes;
+            for (int col = 0; col < w; ++col) {
+                std::uint32_t c = 0;
+                if (filter == 1 && palette.size() == 2) {
+                    c = palette[(r[col / 8] >> (7 - col % 8)) & 1];
+                } else if (filter == 1) {
+                    c = palette[std::min<std::size_t>(r[col], palette.size() - 1)];
+                } else if (filter == 2) {
+                    // Gradient: each channel is predicted as left + up - up-left of decoded pixels
+                    // (zero outside the rect).
+                    std::size_t at = static_cast<std::size_t>(col) * 3;
+                    for (std::size_t k = 0; k < 3; ++k) {
+                        int left = col > 0 ? gradRow_[at - 3 + k] : 0;
+                        int upLeft = col > 0 ? gradPrev_[at - 3 + k] : 0;
+                        int pred = std::clamp(left + gradPrev_[at + k] - upLeft, 0, 255);
+                        gradRow_[at + k] = static_cast<std::uint8_t>(pred + r[at + k]);
+                    }
+                    c = tightPixel(gradRow_.data() + at);
+                } else {
+                    c = tightPixel(r + static_cast<std::size_t>(col) * 3);
+                }
+                putPixel(x + col, y + row, c);
+            }
+            if (filter == 2) gradPrev_.swap(gradRow_);
+        }
+        return true;
+    }
+
+    bool decodeZrle(RfbSource& in, int x, int y, int w, int h) {
+        std::uint8_t lenBuf[4];
+        if (!in.read(lenBuf, 4)) return false;
+        std::size_t len = rd32(lenBuf);
+        zbuf_.resize(len);
+        if (!in.read(zbuf_.data(), len)) return false;
+        pixels_.clear();
+        if (!zrle_.inflateAll(zbuf_.data(), len, pixels_)) {
+            error_ = "zrle zlib error";
+            return false;
+        }
+
+        ByteReader z{pixels_.data(), pixels_.size()};
+        std::uint32_t palette[128];
+        for (int ty = y; ty < y + h; ty += 64) {
+            int th = std::min(64, y + h - ty);
+            for (int tx = x; tx < x + w; tx += 64) {
+                int tw = std::min(64, x + w - tx);
+                int sub = z.u8();
+                bool rle = (sub & 0x80) != 0;
+                int paletteSize = sub & 0x7f;
+                for (int i = 0; i < paletteSize; ++i) {
+                    const std::uint8_t* p = z.take(3);
+                    palette[i] = p ? zrlePixel(p) : 0;
+                }
+
+                if (sub == 0) { // raw CPIXELs
+                    for (int row = 0; row < th; ++row) {
+                        for (int col = 0; col < tw; ++col) {
+                            const std::uint8_t* p = z.take(3);
+                            if (!p) break;
+                            putPixel(tx + col, ty + row, zrlePixel(p));
+                        }
+                    }
+                } else if (sub == 1) { // solid
+                    fillRect(tx, ty, tw, th, palette[0]);
+                } else if (!rle && paletteSize <= 16) { // packed palette
+                    int bits = paletteSize == 2 ? 1 : (paletteSize <= 4 ? 2 : 4);
+                    for (int row = 0; row < th; ++row) {
+                        std::uint8_t byte = 0;
+                        int left = 0;
+                        for (int col = 0; col < tw; ++col) {
+                            if (left == 0) {
+                                byte = z.u8();
+                                left = 8;
+                            }
+                            left -= bits;
+                            putPixel(tx + col, ty + row, palette[(byte >> left) & ((1 << bits) - 1)]);
+                        }
+                    }
+                } else if (rle && (paletteSize == 0 || paletteSize >= 2)) { // plain / palette RLE
+                    int total = tw * th;
+                    for (int i = 0; i < total && z.ok;) {
+                        std::uint32_t c = 0;
+                        int run = 1;
+                        if (paletteSize == 0) {
+                            const std::uint8_t* p = z.take(3);
+                            c = p ? zrlePixel(p) : 0;
+                            run = readZrleRunLength(z);
+                        } else {
+                            int idx = z.u8();
+                            c = palette[std::min(idx & 0x7f, paletteSize - 1)];
+                            if (idx & 0x80) run = readZrleRunLength(z);
+                        }
+                        for (int k = 0; k < run && i < total; ++k, ++i) {
+                            putPixel(tx + i % tw, ty + i / tw, c);
+                        }
+                    }
+                } else {
+                    error_ = "bad zrle subencoding " + std::to_string(sub);
+                    return false;
+                }
+                if (!z.ok) {
+                    error_ = "zrle data too short";
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static int readZrleRunLength(ByteReader& in) {
+        int run = 1;
+        std::uint8_t b = 0;
+        do {
+            b = in.u8();
+            run += b;
+        } while (b == 255 && in.ok);
+        return run;
+    }
+
+    void copyRect(int sx, int sy, int dx, int dy, int w, int h) {
+        int fw = width_;
+        if (sx + w > fw || dx + w > fw || sy + h > height_ || dy + h > height_) return;
+        std::vector<std::uint32_t> tmp(static_cast<std::size_t>(w) * static_cast<std::size_t>(h));
+        for (int row = 0; row < h; ++row) {
+            std::memcpy(tmp.data() + static_cast<std::size_t>(row) * w,
+                        fb_.data() + static_cast<std::size_t>(sy + row) * fw + sx, static_cast<std::size_t>(w) * 4);
+        }
+        for (int row = 0; row < h; ++row) {
+            std::memcpy(fb_.data() + static_cast<std::size_t>(dy + row) * fw + dx,
+                        tmp.data() + static_cast<std::size_t>(row) * w, static_cast<std::size_t>(w) * 4);
+        }
+    }
+
+    int width_ = 0;
+    int height_ = 0;
+    std::string error_;
+    std::vector<std::uint32_t> fb_;
+    Inflater     zrle_;
+    Inflater     tight_[4];
+    std::vector<std::uint8_t> zbuf_;    // compressed rect payload
+    std::vector<std::uint8_t> pixels_;  // inflated rect payload
+    std::vector<std::uint8_t> gradRow_; // Tight gradient filter: current / previous decoded row
+    std::vector<std::uint8_t> gradPrev_;
+};
@@ -0,0 +1,711 @@
+// rfb_loadgen.cpp
+// Headless multi-viewer load generator for the noVNC/RFB output path.
+// Открывает N RFB-сессий (напрямую к x11vnc или через websockify, как noVNC), часть клиентов
+// "водит" камеру стрелками как gyro.html, все декодируют апдейты в локальный framebuffer.
+// В конце печатает per-client fps / задержки / трафик и агрегат (или одну CSV-строку).
+//
+// Usage:
+//   rfb_loadgen [--url rfb://127.0.0.1:5900 | ws://127.0.0.1:6080/websockify]
+//               [--clients N] [--drivers K] [--duration SEC] [--ramp-ms MS] [--csv]
+//               [--encodings copyrect,tight,zrle,raw] [--quality 0..9|-1] [--compress 0..9|-1]
+//               [--pan-min-pct PCT]
+//
+// Encodings default to noVNC's preference order and its quality/compression levels, so the
+// server spends the same encoding CPU per viewer as with real browsers. Tight JPEG/zlib and
+// ZRLE are parsed and inflated; JPEG payloads are consumed but not decoded into the framebuffer.
+//
+// Only the RFB "None" security type is supported (run the stack without VNC_PASSWORD).
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rfb_decode.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Options {
+    std::string scheme = "rfb";
+    std::string host = "127.0.0.1";
+    int         port = 5900;
+    std::string path = "/websockify";
+    int         clients = 1;
+    int         drivers = 1;     // clients that send gyro-style arrow keys; the rest only watch
+    double      durationSec = 20.0;
+    int         rampMs = 50;
+    bool        csv = false;
+    // SetEncodings payload; noVNC sends CopyRect, Tight, ..., ZRLE, ..., Raw, quality 6, compression 2.
+    std::vector<std::int32_t> encodings = {1, 7, 16, 0};
+    int         quality = 6;     // -1 = do not send the pseudo-encoding (no JPEG from Tight)
+    int         compress = 2;
+    // Input latency counts the first update after key-down that repaints at least this much
+    // of the framebuffer: a camera pan moves the whole view, a clock/gears animation does not.
+    double      panMinPct = 25.0;
+};
+
+bool parseEncodings(const std::string& list, std::vector<std::int32_t>& out) {
+    out.clear();
+    std::size_t pos = 0;
+    while (pos <= list.size()) {
+        std::size_t comma = list.find(',', pos);
+        std::string name = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        if (name == "raw") out.push_back(ENC_RAW);
+        else if (name == "copyrect") out.push_back(ENC_COPYRECT);
+        else if (name == "tight") out.push_back(ENC_TIGHT);
+        else if (name == "zrle") out.push_back(ENC_ZRLE);
+        else return false;
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    return !out.empty();
+}
+
+bool parseUrl(const std::string& url, Options& o) {
+    std::size_t sep = url.find("://");
+    if (sep == std::string::npos) return false;
+    o.scheme = url.substr(0, sep);
+    if (o.scheme != "rfb" && o.scheme != "ws") return false;
+    std::string rest = url.substr(sep + 3);
+    std::size_t slash = rest.find('/');
+    if (slash != std::string::npos) {
+        o.path = rest.substr(slash);
+        rest = rest.substr(0, slash);
+    }
+    std::size_t colon = rest.rfind(':');
+    o.port = (o.scheme == "ws") ? 6080 : 5900;
+    if (colon != std::string::npos) {
+        o.port = std::atoi(rest.c_str() + colon + 1);
+        rest = rest.substr(0, colon);
+    }
+    o.host = rest;
+    return !o.host.empty() && o.port > 0;
+}
+
+// ---------- транспорт: TCP или WebSocket (binary) поверх TCP ----------
+
+// The socket belongs to the client thread; main() only calls shutdownNow() at the deadline.
+// fd_ changes (connect, close) and shutdownNow() are serialized by fdMu_, so the shutdown never
+// races an assignment or hits a descriptor number that was closed and reused meanwhile.
+class Conn : public RfbSource {
+public:
+    ~Conn() {
+        std::lock_guard<std::mutex> lock(fdMu_);
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool open(const Options& o, std::string& err) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        std::string port = std::to_string(o.port);
+        if (getaddrinfo(o.host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+            err = "cannot resolve " + o.host;
+            return false;
+        }
+        int fd = -1;
+        for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+            fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if (fd < 0) {
+            err = "connect failed: " + o.host + ":" + port;
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        {
+            std::lock_guard<std::mutex> lock(fdMu_);
+            if (shutdown_) {
+                // Connected after the deadline: nobody would unblock the reads any more.
+                ::close(fd);
+                err = "connected after shutdown";
+                return false;
+            }
+            fd_ = fd;
+        }
+
+        ws_ = (o.scheme == "ws");
+        if (ws_ && !wsHandshake(o, err)) return false;
+        return true;
+    }
+
+    // Unblocks a reader stuck in recv() so the client thread can exit at the deadline.
+    void shutdownNow() {
+        std::lock_guard<std::mutex> lock(fdMu_);
+        shutdown_ = true;
+        if (fd_ >= 0) ::shutdown(fd_, SHUT_RDWR);
+    }
+
+    bool read(void* dst, std::size_t n) override {
+        if (!ws_) return rawRead(dst, n);
+        auto* out = static_cast<std::uint8_t*>(dst);
+        while (n > 0) {
+            if (wsPos_ == wsBuf_.size()) {
+                wsBuf_.clear();
+                wsPos_ = 0;
+                if (!wsReadFrame()) return false;
+                continue;
+            }
+            std::size_t take = std::min(n, wsBuf_.size() - wsPos_);
+            std::memcpy(out, wsBuf_.data() + wsPos_, take);
+            wsPos_ += take;
+            out += take;
+            n -= take;
+        }
+        return true;
+    }
+
+    // Thread-safe: the input thread and the reader (update requests) both write.
+    bool write(const void* src, std::size_t n) {
+        std::lock_guard<std::mutex> lock(writeMu_);
+        if (!ws_) return rawWrite(src, n);
+
+        std::uint8_t hdr[14];
+        std::size_t h = 0;
+        hdr[h++] = 0x82; // FIN + binary
+        if (n < 126) {
+            hdr[h++] = static_cast<std::uint8_t>(0x80 | n);
+        } else if (n < 65536) {
+            hdr[h++] = 0x80 | 126;
+            wr16(hdr + h, static_cast<std::uint16_t>(n));
+            h += 2;
+        } else {
+            hdr[h++] = 0x80 | 127;
+            wr32(hdr + h, static_cast<std::uint32_t>(static_cast<std::uint64_t>(n) >> 32));
+            wr32(hdr + h + 4, static_cast<std::uint32_t>(n));
+            h += 8;
+        }
+        std::uint32_t maskKey = static_cast<std::uint32_t>(rng_());
+        std::uint8_t mask[4];
+        wr32(mask, maskKey);
+        std::memcpy(hdr + h, mask, 4);
+        h += 4;
+
+        std::vector<std::uint8_t> frame(hdr, hdr + h);
+        const auto* p = static_cast<const std::uint8_t*>(src);
+        for (std::size_t i = 0; i < n; ++i) frame.push_back(p[i] ^ mask[i & 3]);
+        return rawWrite(frame.data(), frame.size());
+    }
+
+    std::uint64_t bytesIn() const { return bytesIn_.load(std::memory_order_relaxed); }
+
+private:
+    bool rawRead(void* dst, std::size_t n) {
+        auto* p = static_cast<std::uint8_t*>(dst);
+        while (n > 0) {
+            ssize_t r = ::recv(fd_, p, n, 0);
+            if (r <= 0) return false;
+            bytesIn_.fetch_add(static_cast<std::uint64_t>(r), std::memory_order_relaxed);
+            p += r;
+            n -= static_cast<std::size_t>(r);
+        }
+        return true;
+    }
+
+    bool rawWrite(const void* src, std::size_t n) {
+        const auto* p = static_cast<const std::uint8_t*>(src);
+        while (n > 0) {
+            ssize_t w = ::send(fd_, p, n, MSG_NOSIGNAL);
+            if (w <= 0) return false;
+            p += w;
+            n -= static_cast<std::size_t>(w);
+        }
+        return true;
+    }
+
+    bool wsHandshake(const Options& o, std::string& err) {
+        static const char B64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::uint8_t nonce[16];
+        for (auto& b : nonce) b = static_cast<std::uint8_t>(rng_());
+        std::string key;
+        for (int i = 0; i < 16; i += 3) {
+            std::uint32_t v = static_cast<std::uint32_t>(nonce[i]) << 16;
+            if (i + 1 < 16) v |= static_cast<std::uint32_t>(nonce[i + 1]) << 8;
+            if (i + 2 < 16) v |= nonce[i + 2];
+            key += B64[(v >> 18) & 63];
+            key += B64[(v >> 12) & 63];
+            key += (i + 1 < 16) ? B64[(v >> 6) & 63] : '=';
+            key += (i + 2 < 16) ? B64[v & 63] : '=';
+        }
+
+        std::string req = "GET " + o.path + " HTTP/1.1\r\n"
+                          "Host: " + o.host + ":" + std::to_string(o.port) + "\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: " + key + "\r\n"
+                          "Sec-WebSocket-Version: 13\r\n"
+                          "Sec-WebSocket-Protocol: binary\r\n\r\n";
+        if (!rawWrite(req.data(), req.size())) {
+            err = "websocket handshake write failed";
+            return false;
+        }
+
+        // Byte-wise so that nothing past the header is consumed.
+        std::string resp;
+        char c = 0;
+        while (resp.size() < 8192 && resp.find("\r\n\r\n") == std::string::npos) {
+            if (!rawRead(&c, 1)) break;
+            resp += c;
+        }
+        if (resp.compare(0, 12, "HTTP/1.1 101") != 0) {
+            err = "websocket upgrade refused: " + resp.substr(0, resp.find('\r'));
+            return false;
+        }
+        return true;
+    }
+
+    bool wsReadFrame() {
+        for (;;) {
+            std::uint8_t h[2];
+            if (!rawRead(h, 2)) return false;
+            int opcode = h[0] & 0x0f;
+            std::uint64_t len = h[1] & 0x7f;
+            if (len == 126) {
+                std::uint8_t e[2];
+                if (!rawRead(e, 2)) return false;
+                len = rd16(e);
+            } else if (len == 127) {
+                std::uint8_t e[8];
+                if (!rawRead(e, 8)) return false;
+                len = (static_cast<std::uint64_t>(rd32(e)) << 32) | rd32(e + 4);
+            }
+            std::uint8_t mask[4] = {0, 0, 0, 0};
+            bool masked = (h[1] & 0x80) != 0;
+            if (masked && !rawRead(mask, 4)) return false;
+
+            std::size_t base = wsBuf_.size();
+            wsBuf_.resize(base + len);
+            if (len > 0 && !rawRead(wsBuf_.data() + base, len)) return false;
+            if (masked) {
+                for (std::uint64_t i = 0; i < len; ++i) wsBuf_[base + i] ^= mask[i & 3];
+            }
+
+            if (opcode == 0x8) return false;            // close
+            if (opcode == 0x9 || opcode == 0xA) {       // ping/pong: control, not payload
+                std::vector<std::uint8_t> payload(wsBuf_.begin() + static_cast<std::ptrdiff_t>(base), wsBuf_.end());
+                wsBuf_.resize(base);
+                if (opcode == 0x9) {
+                    std::lock_guard<std::mutex> lock(writeMu_);
+                    std::uint8_t pong[6] = {0x8A, static_cast<std::uint8_t>(0x80 | std::min<std::size_t>(payload.size(), 125)), 0, 0, 0, 0};
+                    rawWrite(pong, sizeof(pong));
+                    rawWrite(payload.data(), std::min<std::size_t>(payload.size(), 125));
+                }
+                continue;
+            }
+            if (len > 0) return true;
+        }
+    }
+
+    std::mutex fdMu_;
+    int  fd_ = -1;            // written under fdMu_; read lock-free only by the owning thread
+    bool shutdown_ = false;   // guarded by fdMu_
+    bool ws_ = false;
+    std::vector<std::uint8_t> wsBuf_;
+    std::size_t wsPos_ = 0;
+    std::mutex writeMu_;
+    std::atomic<std::uint64_t> bytesIn_{0};
+    std::minstd_rand rng_{std::random_device{}()};
+};
+
+// ---------- RFB-клиент ----------
+
+struct ClientStats {
+    bool          ok = false;
+    std::string   error;
+    int           fbWidth = 0;
+    int           fbHeight = 0;
+    double        activeSec = 0.0;
+    std::uint64_t updates = 0;        // FramebufferUpdate messages with at least one rect
+    std::uint64_t rects = 0;
+    std::uint64_t pixels = 0;
+    std::uint64_t bytesIn = 0;
+    std::uint64_t inputMissed = 0;    // key downs without a pan-sized update within 1 s or before the next key down
+    std::vector<double> updateLatencyMs; // FramebufferUpdateRequest -> update header
+    std::vector<double> inputLatencyMs;  // key down after an idle period -> first pan-sized update
+};
+
+class Client {
+public:
+    Client(const Options& o, int id, bool driver) : opt_(o), id_(id), driver_(driver) {}
+
+    void run(std::int64_t deadlineNs) {
+        if (!conn_.open(opt_, stats_.error) || !handshake()) {
+            if (stats_.error.empty()) stats_.error = "handshake failed";
+            return;
+        }
+        stats_.ok = true;
+        std::int64_t startNs = nowNs();
+
+        std::thread input;
+        if (driver_) input = std::thread([this, deadlineNs] { inputLoop(deadlineNs); });
+
+        bool alive = requestUpdate(false);
+        while (alive && nowNs() < deadlineNs) {
+            alive = readServerMessage();
+        }
+        if (!alive && nowNs() < deadlineNs && stats_.error.empty()) stats_.error = "connection lost";
+
+        std::int64_t endNs = std::min(nowNs(), deadlineNs);
+        stats_.activeSec = static_cast<double>(endNs - startNs) / 1e9;
+        stats_.bytesIn = conn_.bytesIn();
+        stop_.store(true);
+        if (input.joinable()) input.join();
+
+        // A key down still waiting at the end is a miss only if it already had its full second.
+        std::int64_t pending = pendingInputNs_.exchange(0);
+        if (pending != 0 && endNs - pending > INPUT_TIMEOUT_NS) inputMissed_.fetch_add(1);
+        stats_.inputMissed = inputMissed_.load();
+    }
+
+    void shutdown() { conn_.shutdownNow(); }
+    const ClientStats& stats() const { return stats_; }
+    int id() const { return id_; }
+
+private:
+    bool handshake() {
+        std::uint8_t ver[12];
+        if (!conn_.read(ver, 12)) return false;
+        if (std::memcmp(ver, "RFB ", 4) != 0) {
+            stats_.error = "not an RFB server";
+            return false;
+        }
+        if (!conn_.write("RFB 003.008\n", 12)) return false;
+
+        std::uint8_t count = 0;
+        if (!conn_.read(&count, 1)) return false;
+        if (count == 0) {
+            stats_.error = "server refused connection";
+            return false;
+        }
+        std::vector<std::uint8_t> types(count);
+        if (!conn_.read(types.data(), count)) return false;
+        if (std::find(types.begin(), types.end(), 1) == types.end()) {
+            stats_.error = "no 'None' security type (unset VNC_PASSWORD for load tests)";
+            return false;
+        }
+        std::uint8_t none = 1;
+        if (!conn_.write(&none, 1)) return false;
+        std::uint8_t result[4];
+        if (!conn_.read(result, 4) || rd32(result) != 0) {
+            stats_.error = "security handshake failed";
+            return false;
+        }
+
+        std::uint8_t shared = 1; // like x11vnc -shared: viewers must not kick each other
+        if (!conn_.write(&shared, 1)) return false;
+
+        std::uint8_t init[24];
+        if (!conn_.read(init, 24)) return false;
+        stats_.fbWidth = rd16(init);
+        stats_.fbHeight = rd16(init + 2);
+        if (!conn_.skip(rd32(init + 20))) return false; // desktop name
+
+        // 32bpp little-endian true colour: raw rects are copied into fb_ as-is.
+        std::uint8_t spf[20] = {0};
+        spf[0] = 0; // SetPixelFormat
+        spf[4] = 32; spf[5] = 24; spf[6] = 0; spf[7] = 1;
+        wr16(spf + 8, 255); wr16(spf + 10, 255); wr16(spf + 12, 255);
+        spf[14] = 16; spf[15] = 8; spf[16] = 0;
+        if (!conn_.write(spf, sizeof(spf))) return false;
+
+        std::vector<std::int32_t> encodings = opt_.encodings;
+        if (opt_.quality >= 0) encodings.push_back(ENC_QUALITY_0 + opt_.quality);
+        if (opt_.compress >= 0) encodings.push_back(ENC_COMPRESS_0 + opt_.compress);
+        encodings.push_back(ENC_DESKTOP_SIZE);
+        encodings.push_back(ENC_LAST_RECT);
+        std::vector<std::uint8_t> se(4 + 4 * encodings.size());
+        se[0] = 2;
+        wr16(se.data() + 2, static_cast<std::uint16_t>(encodings.size()));
+        for (std::size_t i = 0; i < encodings.size(); ++i) {
+            wr32(se.data() + 4 + 4 * i, static_cast<std::uint32_t>(encodings[i]));
+        }
+        if (!conn_.write(se.data(), se.size())) return false;
+
+        decoder_.resize(stats_.fbWidth, stats_.fbHeight);
+        return true;
+    }
+
+    bool requestUpdate(bool incremental) {
+        std::uint8_t req[10] = {3, static_cast<std::uint8_t>(incremental ? 1 : 0)};
+        wr16(req + 2, 0);
+        wr16(req + 4, 0);
+        wr16(req + 6, static_cast<std::uint16_t>(stats_.fbWidth));
+        wr16(req + 8, static_cast<std::uint16_t>(stats_.fbHeight));
+        requestNs_ = nowNs();
+        return conn_.write(req, sizeof(req));
+    }
+
+    bool readServerMessage() {
+        std::uint8_t type = 0;
+        if (!conn_.read(&type, 1)) return false;
+        switch (type) {
+            case 0: return readFramebufferUpdate();
+            case 1: { // SetColourMapEntries
+                std::uint8_t h[5];
+                if (!conn_.read(h, 5)) return false;
+                return conn_.skip(static_cast<std::size_t>(rd16(h + 3)) * 6);
+            }
+            case 2: return true; // Bell
+            case 3: { // ServerCutText
+                std::uint8_t h[7];
+                if (!conn_.read(h, 7)) return false;
+                return conn_.skip(rd32(h + 3));
+            }
+            default:
+                stats_.error = "unknown server message " + std::to_string(type);
+                return false;
+        }
+    }
+
+    bool readFramebufferUpdate() {
+        std::uint8_t h[3];
+        if (!conn_.read(h, 3)) return false;
+        std::int64_t arrivedNs = nowNs();
+        int nrects = rd16(h + 1);
+        std::uint64_t updatePixels = 0;
+
+        // nrects = 0xFFFF: count unknown up front, the server ends the update with a LastRect.
+        int seen = 0;
+        for (; nrects == 0xFFFF || seen < nrects; ++seen) {
+            std::uint8_t rh[12];
+            if (!conn_.read(rh, 12)) return false;
+            int x = rd16(rh), y = rd16(rh + 2), w = rd16(rh + 4), hgt = rd16(rh + 6);
+            auto enc = static_cast<std::int32_t>(rd32(rh + 8));
+            if (enc == ENC_LAST_RECT) break;
+            if (enc == ENC_DESKTOP_SIZE) {
+                stats_.fbWidth = w;
+                stats_.fbHeight = hgt;
+                decoder_.resize(w, hgt);
+                continue;
+            }
+            if (!decoder_.decodeRect(conn_, enc, x, y, w, hgt)) {
+                stats_.error = decoder_.error().empty() ? "bad rect, encoding " + std::to_string(enc) : decoder_.error();
+                return false;
+            }
+            updatePixels += static_cast<std::uint64_t>(w) * static_cast<std::uint64_t>(hgt);
+            ++stats_.rects;
+        }
+
+        if (seen > 0) {
+            stats_.pixels += updatePixels;
+            ++stats_.updates;
+            stats_.updateLatencyMs.push_back(static_cast<double>(arrivedNs - requestNs_) / 1e6);
+            noteInputResponse(arrivedNs, updatePixels);
+        }
+        return requestUpdate(true);
+    }
+
+    // The SOURCE desktop keeps animating (xclock, glxgears), so "any update after key-down" would
+    // mostly measure the time to the next animation frame. Only an update that repaints a pan-sized
+    // part of the view counts as the response to the key.
+    void noteInputResponse(std::int64_t arrivedNs, std::uint64_t updatePixels) {
+        std::int64_t inputNs = pendingInputNs_.load();
+        if (inputNs == 0) return;
+        double fbPixels = static_cast<double>(stats_.fbWidth) * static_cast<double>(stats_.fbHeight);
+        if (static_cast<double>(updatePixels) >= fbPixels * opt_.panMinPct / 100.0) {
+            if (pendingInputNs_.compare_exchange_strong(inputNs, 0)) {
+                stats_.inputLatencyMs.push_back(static_cast<double>(arrivedNs - inputNs) / 1e6);
+            }
+        } else if (arrivedNs - inputNs > INPUT_TIMEOUT_NS) {
+            if (pendingInputNs_.compare_exchange_strong(inputNs, 0)) inputMissed_.fetch_add(1);
+        }
+    }
+
+    bool sendKey(std::uint32_t keysym, bool down) {
+        std::uint8_t ev[8] = {4, static_cast<std::uint8_t>(down ? 1 : 0), 0, 0};
+        wr32(ev + 4, keysym);
+        return conn_.write(ev, sizeof(ev));
+    }
+
+    // Gyro-style input like web/gyro.html: a 25 ms tick holds one arrow key while the phone
+    // is tilted and releases it when level. Cycle: 1.5 s tilted (Left/Up/Right/Down in turn),
+    // 1.5 s level. The level phase lets the view settle, so key-down -> next update measures
+    // input latency rather than an already-running animation.
+    void inputLoop(std::int64_t deadlineNs) {
+        const std::uint32_t keys[] = {0xff51, 0xff52, 0xff53, 0xff54}; // Left Up Right Down
+        const std::int64_t cycleNs = 3000000000LL;
+        std::uint32_t held = 0;
+        std::int64_t start = nowNs() + static_cast<std::int64_t>(id_) * 137000000LL;
+
+        while (!stop_.load() && nowNs() < deadlineNs) {
+            std::int64_t t = nowNs() - start;
+            std::uint32_t want = 0;
+            if (t >= 0 && (t % cycleNs) < cycleNs / 2) want = keys[(t / cycleNs) % 4];
+
+            if (want != held) {
+                if (held && !sendKey(held, false)) return;
+                if (want) {
+                    // The previous key down never got its pan-sized update: count it, do not lose it.
+                    if (!held && pendingInputNs_.exchange(nowNs()) != 0) inputMissed_.fetch_add(1);
+                    if (!sendKey(want, true)) return;
+                }
+                held = want;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(25));
+        }
+        if (held) sendKey(held, false);
+    }
+
+    Options opt_;
+    int     id_;
+    bool    driver_;
+    Conn    conn_;
+    ClientStats stats_;
+    RfbDecoder  decoder_;
+    std::int64_t requestNs_ = 0;
+    static constexpr std::int64_t INPUT_TIMEOUT_NS = 1000000000LL;
+    std::atomic<std::int64_t> pendingInputNs_{0};  // key down awaiting its update (input thread -> reader)
+    std::atomic<std::uint64_t> inputMissed_{0};    // bumped by both threads, copied to stats_ in run()
+    std::atomic<bool> stop_{false};
+};
+
+double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    std::size_t idx = static_cast<std::size_t>(p * static_cast<double>(v.size() - 1) + 0.5);
+    return v[std::min(idx, v.size() - 1)];
+}
+
+void usage() {
+    std::fprintf(stderr,
+                 "usage: rfb_loadgen [--url rfb://host:5900 | ws://host:6080/websockify] [--clients N]\n"
+                 "                   [--drivers K] [--duration SEC] [--ramp-ms MS] [--csv]\n"
+                 "                   [--encodings copyrect,tight,zrle,raw] [--quality 0..9|-1] [--compress 0..9|-1]\n"
+                 "                   [--pan-min-pct PCT]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* { return (i + 1 < argc) ? argv[++i] : ""; };
+        if (a == "--url") {
+            if (!parseUrl(next(), opt)) {
+                std::fprintf(stderr, "bad --url (expected rfb://host:port or ws://host:port/path)\n");
+                return 2;
+            }
+        } else if (a == "--clients") {
+            opt.clients = std::max(1, std::atoi(next()));
+        } else if (a == "--drivers") {
+            opt.drivers = std::max(0, std::atoi(next()));
+        } else if (a == "--duration") {
+            opt.durationSec = std::max(1.0, std::atof(next()));
+        } else if (a == "--ramp-ms") {
+            opt.rampMs = std::max(0, std::atoi(next()));
+        } else if (a == "--csv") {
+            opt.csv = true;
+        } else if (a == "--encodings") {
+            if (!parseEncodings(next(), opt.encodings)) {
+                std::fprintf(stderr, "bad --encodings (comma list of copyrect, tight, zrle, raw)\n");
+                return 2;
+            }
+        } else if (a == "--quality") {
+            opt.quality = std::clamp(std::atoi(next()), -1, 9);
+        } else if (a == "--compress") {
+            opt.compress = std::clamp(std::atoi(next()), -1, 9);
+        } else if (a == "--pan-min-pct") {
+            opt.panMinPct = std::clamp(std::atof(next()), 0.0, 100.0);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (int i = 0; i < opt.clients; ++i) {
+        clients.push_back(std::make_unique<Client>(opt, i, i < opt.drivers));
+    }
+
+    // Measurement window starts once every client has been launched.
+    std::int64_t deadlineNs = nowNs() + static_cast<std::int64_t>(opt.rampMs) * 1000000LL * opt.clients +
+                              static_cast<std::int64_t>(opt.durationSec * 1e9);
+    std::vector<std::thread> threads;
+    for (auto& c : clients) {
+        Client* cp = c.get();
+        threads.emplace_back([cp, deadlineNs] { cp->run(deadlineNs); });
+        if (opt.rampMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(opt.rampMs));
+    }
+
+    while (nowNs() < deadlineNs) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (auto& c : clients) c->shutdown();
+    for (auto& t : threads) t.join();
+
+    int failed = 0;
+    double fpsSum = 0.0, fpsMin = 0.0, kbpsSum = 0.0;
+    std::vector<double> allUpdate, allInput;
+    bool first = true;
+    for (auto& c : clients) {
+        const ClientStats& s = c->stats();
+        if (!s.ok) {
+            ++failed;
+            std::fprintf(stderr, "client %d: %s\n", c->id(), s.error.c_str());
+            continue;
+        }
+        double sec = std::max(1e-3, s.activeSec);
+        double fps = static_cast<double>(s.updates) / sec;
+        double kbps = static_cast<double>(s.bytesIn) * 8.0 / 1000.0 / sec;
+        fpsSum += fps;
+        fpsMin = first ? fps : std::min(fpsMin, fps);
+        first = false;
+        kbpsSum += kbps;
+        allUpdate.insert(allUpdate.end(), s.updateLatencyMs.begin(), s.updateLatencyMs.end());
+        allInput.insert(allInput.end(), s.inputLatencyMs.begin(), s.inputLatencyMs.end());
+        if (!opt.csv) {
+            std::printf("client %3d %dx%d fps=%.1f kbps=%.0f px/update=%.0f update_p50=%.1fms update_p95=%.1fms"
+                        " input_p50=%.1fms input_n=%zu input_missed=%llu%s%s\n",
+                        c->id(), s.fbWidth, s.fbHeight, fps, kbps,
+                        s.updates ? static_cast<double>(s.pixels) / static_cast<double>(s.updates) : 0.0,
+                        percentile(s.updateLatencyMs, 0.5), percentile(s.updateLatencyMs, 0.95),
+                        percentile(s.inputLatencyMs, 0.5), s.inputLatencyMs.size(),
+                        static_cast<unsigned long long>(s.inputMissed),
+                        s.error.empty() ? "" : " error=", s.error.c_str());
+        }
+    }
+
+    int okClients = opt.clients - failed;
+    double fpsAvg = okClients > 0 ? fpsSum / okClients : 0.0;
+    if (opt.csv) {
+        std::printf("clients,fps_avg,fps_min,kbps_total,update_p50_ms,update_p95_ms,input_p50_ms,input_p95_ms,failed\n");
+        std::printf("%d,%.2f,%.2f,%.0f,%.2f,%.2f,%.2f,%.2f,%d\n", opt.clients, fpsAvg, fpsMin, kbpsSum,
+                    percentile(allUpdate, 0.5), percentile(allUpdate, 0.95),
+                    percentile(allInput, 0.5), percentile(allInput, 0.95), failed);
+    } else {
+        std::printf("total clients=%d failed=%d fps_avg=%.1f fps_min=%.1f kbps_total=%.0f update_p50=%.1fms"
+                    " update_p95=%.1fms input_p50=%.1fms input_p95=%.1fms\n",
+                    opt.clients, failed, fpsAvg, fpsMin, kbpsSum,
+                    percentile(allUpdate, 0.5), percentile(allUpdate, 0.95),
+                    percentile(allInput, 0.5), percentile(allInput, 0.95));
+    }
+    return failed == opt.clients ? 1 : 0;
+}